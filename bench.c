@@ -0,0 +1,187 @@
+/* Engine microbenchmarks: make bench && ./bench [-csv] [-seed N] [-n N]
+ * Built as one unit with board.c to reach the static hot paths. */
+#include "board.c"
+
+#define POSITIONS 64
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void pick(cl_engine *e, bool busy, int *x, int *y)
+{
+	uint32_t r;
+	do {
+		r = rng_next(e);
+		*x = r % BOARD_W;
+		*y = (r >> 8) % BOARD_H;
+	} while (!cell_get(e, *x, *y) != !busy);
+}
+
+/* a seeded mid-game desk, played with random moves */
+static void position(cl_engine *e, uint64_t seed)
+{
+	cl_turn t;
+	int x1, y1, x2, y2;
+
+	board_seed(e, seed);
+	board_init(e);
+	for (int i = 0; i < 20 && board_running(e); i++) {
+		pick(e, true, &x1, &y1);
+		pick(e, false, &x2, &y2);
+		board_play(e, x1, y1, x2, y2, &t);
+		if (e->Session.free_cells < BOARD_W * BOARD_H / 3)
+			break;
+	}
+	while (!board_waiting(e))
+		board_logic(e);
+}
+
+/* to and back again, so the desk stays as it was */
+static double bench_path(cl_engine *e, uint64_t seed, long n)
+{
+	int x1, y1, x2, y2;
+	long done = 0;
+	double t = 0, t0;
+
+	for (int p = 0; done < n; p++) {
+		position(e, seed + p);
+		if (!board_running(e))
+			continue;
+		t0 = now();
+		for (int i = 0; i < n / POSITIONS; i++) {
+			pick(e, true, &x1, &y1);
+			pick(e, false, &x2, &y2);
+			done++;
+			if (board_move(e, x1, y1, x2, y2)) {
+				memset(e->move_matrix, 0, sizeof(e->move_matrix));
+				board_move(e, x2, y2, x1, y1);
+				done++;
+			}
+			memset(e->move_matrix, 0, sizeof(e->move_matrix));
+		}
+		t += now() - t0;
+	}
+	return done / t;
+}
+
+static double bench_check(cl_engine *e, uint64_t seed, long n)
+{
+	long done = 0;
+	double t = 0, t0;
+
+	for (int p = 0; done < n; p++) {
+		position(e, seed + p);
+		t0 = now();
+		for (int i = 0; i < n / POSITIONS; i++) {
+			board_check_lines(e, true);
+			e->flush_nr = 0;
+			done++;
+		}
+		t += now() - t0;
+	}
+	return done / t;
+}
+
+/* fill the desk up, then empty it untimed */
+static double bench_fill(cl_engine *e, uint64_t seed, long n)
+{
+	long done = 0;
+	double t = 0, t0;
+
+	board_seed(e, seed);
+	board_init(e);
+	while (done < n) {
+		for (int i = 0; i < BOARD_W * BOARD_H; i++) {
+			if ((&e->Session.desk[0][0])[i])
+				cell_put(e, &(&e->Session.desk[0][0])[i], 0);
+		}
+		e->Session.free_cells = BOARD_W * BOARD_H;
+		t0 = now();
+		while (e->Session.free_cells) {
+			e->Session.iball = 0;
+			board_fill(e, NULL, NULL);
+			done++;
+		}
+		t += now() - t0;
+	}
+	return done / t;
+}
+
+/* whole board_play() turns, new game when one is over */
+static double bench_turn(cl_engine *e, uint64_t seed, long n)
+{
+	cl_turn t;
+	int x1, y1, x2, y2;
+	long done = 0;
+	double t0 = now();
+
+	board_seed(e, seed);
+	board_init(e);
+	while (done < n) {
+		if (!board_running(e))
+			board_init(e);
+		pick(e, true, &x1, &y1);
+		pick(e, false, &x2, &y2);
+		if (!board_play(e, x1, y1, x2, y2, &t))
+			done++;
+	}
+	return done / (now() - t0);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = { "path_searches", "full_checks", "spawns", "turns" };
+	double rate[4];
+	uint64_t seed = 1;
+	long n = 1000000;
+	bool csv = false;
+	cl_engine *e;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-csv"))
+			csv = true;
+		else if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+			seed = strtoull(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			n = strtol(argv[++i], NULL, 0);
+			n = _max(n, POSITIONS);
+		} else {
+			fprintf(stderr, "usage: %s [-csv] [-seed N] [-n N]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (!(e = board_new())) {
+		fprintf(stderr, "Couldn't create game engine\n");
+		return 1;
+	}
+	rate[0] = bench_path(e, seed, n);
+	rate[1] = bench_check(e, seed, n);
+	rate[2] = bench_fill(e, seed, n);
+	rate[3] = bench_turn(e, seed, n / 10);
+	board_free(e);
+
+#ifdef BITBOARD
+	const char *engine = "bitboard";
+#else
+	const char *engine = "scanner";
+#endif
+	if (csv) {
+		printf("engine,seed,n");
+		for (int i = 0; i < 4; i++)
+			printf(",%s_per_sec", names[i]);
+		printf("\n%s,%llu,%ld", engine, (unsigned long long)seed, n);
+		for (int i = 0; i < 4; i++)
+			printf(",%.0f", rate[i]);
+		printf("\n");
+	} else {
+		printf("{\"engine\": \"%s\", \"seed\": %llu, \"n\": %ld", engine, (unsigned long long)seed, n);
+		for (int i = 0; i < 4; i++)
+			printf(", \"%s_per_sec\": %.0f", names[i], rate[i]);
+		printf("}\n");
+	}
+	return 0;
+}
@@ -0,0 +1,109 @@
+/* Blit throughput with assets as they used to be loaded (before) and in the
+ * screen format (after): make blitbench && ./blitbench [-csv] [-n N] */
+#include <SDL.h>
+#include <SDL_image.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCREEN_W 800
+#define SCREEN_H 480
+#define SCREEN_FORMAT SDL_PIXELFORMAT_ARGB8888
+
+static SDL_Surface *screen;
+
+static SDL_Surface *load(const char *file, Uint32 format, bool opaque)
+{
+	char path[256];
+	SDL_Surface *img, *conv;
+
+	snprintf(path, sizeof(path), "gfx/%s", file);
+	if (!(img = IMG_Load(path))) {
+		fprintf(stderr, "Couldn't load '%s': %s\n", path, IMG_GetError());
+		exit(1);
+	}
+	if (!(conv = SDL_ConvertSurfaceFormat(img, format, 0))) {
+		fprintf(stderr, "Couldn't convert '%s': %s\n", path, SDL_GetError());
+		exit(1);
+	}
+	SDL_FreeSurface(img);
+	if (opaque)
+		SDL_SetSurfaceBlendMode(conv, SDL_BLENDMODE_NONE);
+	return conv;
+}
+
+/* blits per second of a w x h part of src */
+static double bench_blit(SDL_Surface *src, int w, int h, long n)
+{
+	SDL_Rect from = { 0, 0, w, h }, to;
+	Uint64 t0 = SDL_GetPerformanceCounter();
+
+	for (long i = 0; i < n; i++) {
+		to.x = (i * 7) % (SCREEN_W - w + 1);
+		to.y = (i * 13) % (SCREEN_H - h + 1);
+		SDL_BlitSurface(src, &from, screen, &to);
+	}
+	return n / ((double)(SDL_GetPerformanceCounter() - t0) / SDL_GetPerformanceFrequency());
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = { "bg_full", "bg_tile", "ball", "ball_tile" };
+	SDL_Surface *before[4], *after[4];
+	int w[4], h[4];
+	double rate[4][2];
+	long n = 2000;
+	bool csv = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-csv"))
+			csv = true;
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			n = strtol(argv[++i], NULL, 0);
+			n = n > 1 ? n : 1;
+		} else {
+			fprintf(stderr, "usage: %s [-csv] [-n N]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (SDL_Init(0) < 0 || !(screen = SDL_CreateRGBSurfaceWithFormat(0, SCREEN_W, SCREEN_H, 32, SCREEN_FORMAT))) {
+		fprintf(stderr, "Couldn't initialize SDL: %s\n", SDL_GetError());
+		return 1;
+	}
+	/* the background was RGB565, generated balls RGBA8888 */
+	before[0] = before[1] = load("bg.png", SDL_PIXELFORMAT_RGB565, false);
+	after[0]  = after[1]  = load("bg.png", SCREEN_FORMAT, true);
+	before[2] = before[3] = load("joker.png", SDL_PIXELFORMAT_RGBA8888, false);
+	after[2]  = after[3]  = load("joker.png", SCREEN_FORMAT, false);
+	w[0] = SCREEN_W; h[0] = SCREEN_H;
+	w[1] = 50;       h[1] = 50;
+	w[2] = after[2]->w; h[2] = after[2]->h;
+	w[3] = 25;       h[3] = 25;
+
+	for (int i = 0; i < 4; i++) {
+		long k = n * (SCREEN_W * SCREEN_H) / (w[i] * h[i]); /* about the same pixels */
+		rate[i][0] = bench_blit(before[i], w[i], h[i], k);
+		rate[i][1] = bench_blit(after[i], w[i], h[i], k);
+	}
+	if (csv) {
+		printf("case,w,h,before_per_sec,after_per_sec,speedup\n");
+		for (int i = 0; i < 4; i++)
+			printf("%s,%d,%d,%.0f,%.0f,%.2f\n", names[i], w[i], h[i],
+				rate[i][0], rate[i][1], rate[i][1] / rate[i][0]);
+	} else {
+		printf("{\"screen\": \"%s\", \"n\": %ld", SDL_GetPixelFormatName(SCREEN_FORMAT), n);
+		for (int i = 0; i < 4; i++)
+			printf(", \"%s\": {\"w\": %d, \"h\": %d, \"before_per_sec\": %.0f, \"after_per_sec\": %.0f}",
+				names[i], w[i], h[i], rate[i][0], rate[i][1]);
+		printf("}\n");
+	}
+	SDL_FreeSurface(before[0]);
+	SDL_FreeSurface(after[0]);
+	SDL_FreeSurface(before[2]);
+	SDL_FreeSurface(after[2]);
+	SDL_FreeSurface(screen);
+	SDL_Quit();
+	return 0;
+}
@@ -1,6 +1,17 @@
-#include "main.h"
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
 #include "board.h"
 
+#ifndef _max
+#define _max(a,b) (((a)>(b))?(a):(b))
+#endif
+
 #define FL_PATH 0x80
 #define BONUS_PCNT 5
 
@@ -14,13 +25,7 @@ enum {
 	END
 } __BOARDSTATE__;
 
-cell_t	move_matrix_ids[BOARD_W][BOARD_H];
-cell_t	move_matrix[BOARD_W][BOARD_H];
-
-int	ball_x = -1, ball_to_x;
-int	ball_y = -1, ball_to_y;
-
-static struct __SESS__ {
+struct __SESS__ {
 	cell_t	desk[BOARD_W][BOARD_H];
 	cell_t	ball_pool[POOL_SIZE];
 	unsigned int score;
@@ -29,10 +34,7 @@ static struct __SESS__ {
 	unsigned int free_cells;
 	unsigned int iball;
 	int last_time;
-} Session;
-
-static unsigned int flush_nr;
-static unsigned int board_state;
+};
 
 typedef struct {
 	int x;
@@ -46,153 +48,479 @@ typedef struct {
 	} cells[_max(BOARD_W,BOARD_H)];
 } flush_t;
 
-flush_t	*flushes[BOARD_W * BOARD_H];
+/* a run of one direction starts at most once per cell */
+#ifdef BOARD_DEBUG
+#define FLUSH_MAX (2 * 4 * BOARD_W * BOARD_H) /* the full scan lands behind */
+#else
+#define FLUSH_MAX (4 * BOARD_W * BOARD_H)
+#endif
+
+#ifdef BITBOARD
+/* Bitboard mirror of Session.desk: one occupancy mask per cell type
+ * (mask[0] holds the empty cells), cell (x, y) lives at bit
+ * y * BITS_STRIDE + x. The extra column per row is always zero, so
+ * shifts along a row or a diagonal never wrap into the next row. */
+#if !defined(__SIZEOF_INT128__)
+#error "BITBOARD needs a compiler with 128-bit integers"
+#endif
+#define BITS_STRIDE (BOARD_W + 1)
+#if BOARD_H * BITS_STRIDE > 128
+#error "board is too big for BITBOARD"
+#endif
+typedef unsigned __int128 bits_t;
+#endif
+#if (!defined(BITBOARD) || defined(BOARD_DEBUG)) && BOARD_W + BOARD_H - 1 > 32
+#error "board is too big for the line masks"
+#endif
+
+/* BOARD_DEBUG keeps the scanners next to the bitboard to check it against */
+#if !defined(BITBOARD) || defined(BOARD_DEBUG)
+#define LINE_SCANNERS
+#endif
+
+/* saved right after the session, older saves simply lack it */
+struct __RNG__ {
+	uint64_t seed;  /* as given to board_seed() */
+	uint64_t state; /* PCG32 */
+};
+
+#define SNAP_WORDS ((sizeof(cl_snapshot) + 3) / 4)
+#define EVENTS_NR 64 /* power of two */
+
+/* everything one game needs; nothing here is shared between engines */
+struct cl_engine {
+	struct __SESS__ Session;
+	struct __RNG__ rng;
+
+	cell_t	move_matrix_ids[BOARD_W][BOARD_H];
+	cell_t	move_matrix[BOARD_W][BOARD_H];
+
+	int	ball_x, ball_to_x;
+	int	ball_y, ball_to_y;
 
-SDL_mutex *board_mutex;
+	struct {
+		cell_t nr;
+		cell_t cell[4];
+	} neighbours[BOARD_W * BOARD_H]; /* by x * BOARD_H + y */
 
-void board_lock(void)
-{
-	SDL_mutexP(board_mutex);
-}
+	/* distance field from the selected ball, dropped on any desk change */
+	struct {
+		cell_t dist[BOARD_W][BOARD_H];
+		int x, y;
+		bool valid;
+	} reach;
 
-void board_unlock(void)
-{
-	SDL_mutexV(board_mutex);
-}
+	/* board_logic() state carried between steps */
+	struct {
+		bool rc;
+		int x, y;
+	} logic;
+
+	unsigned int flush_nr;
+	unsigned int board_state;
+
+	flush_t	flushes[FLUSH_MAX]; /* emptied by every REMOVE step */
+
+	/* empty cells packed at the front, and where each one sits there */
+	unsigned short free_cell[BOARD_W * BOARD_H]; /* x * BOARD_H + y */
+	unsigned short free_pos[BOARD_W * BOARD_H];
+	unsigned int free_nr;
+
+	/* what was put on the desk since the last check */
+#ifdef BITBOARD
+	bits_t bits_mask[ball_max];
+	bits_t dirty_cells;
+#else
+	struct {
+		unsigned int h, v, a, b; /* by y, x, x + y and x - y + BOARD_H - 1 */
+	} dirty_lines;
+#endif
 
-static cell_t cell_get(int x, int y)
+	/* seqlock over the last published cl_snapshot, stored word by word */
+	struct {
+		_Atomic uint32_t seq; /* odd while a publish runs */
+		_Atomic uint32_t word[SNAP_WORDS];
+		unsigned int version;
+		bool hold; /* board_play() publishes once, at the end */
+	} snap;
+
+	/* single producer, single consumer ring of cl_event */
+	struct {
+		bool on;
+		_Atomic unsigned int head; /* written by the engine's thread only */
+		_Atomic unsigned int tail; /* by the reader only */
+		_Atomic bool lost;
+		cl_event *rec;      /* open event, cell_put() adds to it */
+		cl_event scratch;   /* recorded into while the ring is full */
+		cl_event ring[EVENTS_NR];
+	} ev;
+};
+
+static cell_t cell_get(cl_engine *e, int x, int y)
 {
 	if (x < 0 || x >= BOARD_W)
 		return 0;
 	if (y < 0 || y >= BOARD_H)
 		return 0;
-	return Session.desk[x][y];
+	return e->Session.desk[x][y];
+}
+
+#ifdef BITBOARD
+static bits_t cell_bit(int x, int y)
+{
+	return (bits_t)1 << (y * BITS_STRIDE + x);
+}
+
+static void bits_sync(cl_engine *e)
+{
+	int x, y;
+	memset(e->bits_mask, 0, sizeof(e->bits_mask));
+	for (y = 0; y < BOARD_H; y++) {
+		for (x = 0; x < BOARD_W; x++)
+			e->bits_mask[e->Session.desk[x][y]] |= cell_bit(x, y);
+	}
+}
+#endif
+
+static void free_add(cl_engine *e, int i)
+{
+	e->free_pos[i] = e->free_nr;
+	e->free_cell[e->free_nr++] = i;
+}
+
+static void free_del(cl_engine *e, int i) /* the last one fills the hole */
+{
+	int last = e->free_cell[--e->free_nr];
+	e->free_cell[e->free_pos[i]] = last;
+	e->free_pos[last] = e->free_pos[i];
+}
+
+static void free_sync(cl_engine *e)
+{
+	e->free_nr = 0;
+	for (int i = 0; i < BOARD_W * BOARD_H; i++) {
+		if (!(&e->Session.desk[0][0])[i])
+			free_add(e, i);
+	}
+}
+
+/* every write to the desk goes through here to keep the masks in sync */
+static void cell_put(cl_engine *e, cell_t *c, cell_t v)
+{
+	int i = c - &e->Session.desk[0][0];
+	int x = i / BOARD_H;
+	int y = i % BOARD_H;
+	cl_event *ev = e->ev.rec;
+	if (ev && ev->nr < BOARD_W * BOARD_H) {
+		ev->cells[ev->nr].x    = x;
+		ev->cells[ev->nr].y    = y;
+		ev->cells[ev->nr].was  = *c;
+		ev->cells[ev->nr].ball = v;
+		ev->nr++;
+	}
+#ifdef BITBOARD
+	bits_t bit = cell_bit(x, y);
+	e->bits_mask[*c] &= ~bit;
+	e->bits_mask[v]  |= bit;
+	if (v)
+		e->dirty_cells |= bit;
+#else
+	if (v) {
+		e->dirty_lines.h |= 1u << y;
+		e->dirty_lines.v |= 1u << x;
+		e->dirty_lines.a |= 1u << (x + y);
+		e->dirty_lines.b |= 1u << (x - y + BOARD_H - 1);
+	}
+#endif
+	if (!*c != !v) {
+		if (v)
+			free_del(e, i);
+		else
+			free_add(e, i);
+	}
+	*c = v;
+	e->reach.valid = false;
+}
+
+static void dirty_clear(cl_engine *e)
+{
+#ifdef BITBOARD
+	e->dirty_cells = 0;
+#else
+	memset(&e->dirty_lines, 0, sizeof(e->dirty_lines));
+#endif
+}
+
+static void board_neighbours(cl_engine *e)
+{
+	int x, y;
+	for (x = 0; x < BOARD_W; x++) {
+		for (y = 0; y < BOARD_H; y++) {
+			cell_t nr = 0;
+			cell_t *n = e->neighbours[x * BOARD_H + y].cell;
+			if (x > 0)
+				n[nr++] = (x - 1) * BOARD_H + y;
+			if (x < BOARD_W - 1)
+				n[nr++] = (x + 1) * BOARD_H + y;
+			if (y > 0)
+				n[nr++] = x * BOARD_H + y - 1;
+			if (y < BOARD_H - 1)
+				n[nr++] = x * BOARD_H + y + 1;
+			e->neighbours[x * BOARD_H + y].nr = nr;
+		}
+	}
+}
+
+static uint32_t rng_next(cl_engine *e)
+{
+	uint64_t old = e->rng.state;
+	uint32_t xs  = ((old >> 18) ^ old) >> 27;
+	uint32_t rot = old >> 59;
+	e->rng.state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (xs >> rot) | (xs << (-rot & 31));
+}
+
+void board_seed(cl_engine *e, uint64_t seed)
+{
+	e->rng.seed  = seed;
+	e->rng.state = 0;
+	rng_next(e);
+	e->rng.state += seed;
+	rng_next(e);
+}
+
+uint64_t board_get_seed(cl_engine *e)
+{
+	return e->rng.seed;
+}
+
+static void board_publish(cl_engine *e);
+
+/* Opens an event, NULL if they are off. Until ev_end() every desk change is
+ * recorded into it. A full ring drops it and leaves board_events_lost(). */
+static cl_event *ev_begin(cl_engine *e, int type, int x, int y, cell_t ball)
+{
+	cl_event *ev;
+	unsigned int head;
+
+	if (!e->ev.on)
+		return NULL;
+	head = atomic_load_explicit(&e->ev.head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&e->ev.tail, memory_order_acquire) >= EVENTS_NR) {
+		atomic_store_explicit(&e->ev.lost, true, memory_order_relaxed);
+		ev = &e->ev.scratch;
+	} else
+		ev = &e->ev.ring[head % EVENTS_NR];
+	ev->type  = type;
+	ev->x     = x;
+	ev->y     = y;
+	ev->ball  = ball;
+	ev->slot  = 0;
+	ev->score = ev->score_mul = 0;
+	ev->nr    = 0;
+	return e->ev.rec = ev;
+}
+
+static void ev_end(cl_engine *e)
+{
+	unsigned int head;
+
+	if (!e->ev.rec)
+		return;
+	if (e->ev.rec != &e->ev.scratch) {
+		head = atomic_load_explicit(&e->ev.head, memory_order_relaxed);
+		atomic_store_explicit(&e->ev.head, head + 1, memory_order_release);
+	}
+	e->ev.rec = NULL;
+}
+
+void board_events(cl_engine *e, bool on)
+{
+	e->ev.on = on;
+}
+
+const cl_event *board_event(cl_engine *e)
+{
+	unsigned int tail = atomic_load_explicit(&e->ev.tail, memory_order_relaxed);
+	if (tail == atomic_load_explicit(&e->ev.head, memory_order_acquire))
+		return NULL;
+	return &e->ev.ring[tail % EVENTS_NR];
 }
 
-bool board_selected(int *x, int *y)
+void board_event_done(cl_engine *e)
 {
-	board_lock();
-	bool selected = !!cell_get(ball_x, ball_y);
-	//fprintf(stderr,"Board selected: %d %d\n", ball_x, ball_y);
+	unsigned int tail = atomic_load_explicit(&e->ev.tail, memory_order_relaxed);
+	if (tail != atomic_load_explicit(&e->ev.head, memory_order_acquire))
+		atomic_store_explicit(&e->ev.tail, tail + 1, memory_order_release);
+}
+
+bool board_events_lost(cl_engine *e)
+{
+	return atomic_exchange_explicit(&e->ev.lost, false, memory_order_relaxed);
+}
+
+cl_engine *board_new(void)
+{
+	cl_engine *e = calloc(1, sizeof(cl_engine));
+	if (e) {
+		e->ball_x = e->ball_to_x = -1;
+		e->ball_y = e->ball_to_y = -1;
+		e->board_state = END;
+		board_neighbours(e);
+		board_seed(e, (uint64_t)time(NULL) ^ (uintptr_t)e);
+		board_publish(e);
+	}
+	return e;
+}
+
+void board_free(cl_engine *e)
+{
+	free(e);
+}
+
+bool board_selected(cl_engine *e, int *x, int *y)
+{
+	bool selected = !!cell_get(e, e->ball_x, e->ball_y);
+	//fprintf(stderr,"Board selected: %d %d\n", e->ball_x, e->ball_y);
 	if ( selected ) {
 		if (x)
-			*x = ball_x;
+			*x = e->ball_x;
 		if (y)
-			*y = ball_y;
+			*y = e->ball_y;
 	}
-	board_unlock();
 	return selected;
 }
 
-bool board_moved(int *x, int *y)
+bool board_moved(cl_engine *e, int *x, int *y)
 {
-	board_lock();
-	bool moved = ball_to_x > -1 && ball_to_y > -1 && board_state == CHECK;
-	//fprintf(stderr,"Ball moved: %d %d\n", ball_to_x, ball_to_y);
+	bool moved = e->ball_to_x > -1 && e->ball_to_y > -1 && e->board_state == CHECK;
+	//fprintf(stderr,"Ball moved: %d %d\n", e->ball_to_x, e->ball_to_y);
 	if ( moved ) {
 		if (x)
-			*x = ball_to_x;
+			*x = e->ball_to_x;
 		if (y)
-			*y = ball_to_y;
+			*y = e->ball_to_y;
 	}
-	board_unlock();
 	return moved;
 }
 
-void board_init(void)
+/* Engine side of board_snapshot(), on every change a renderer can see */
+static void board_publish(cl_engine *e)
 {
-	if (board_mutex)
-		SDL_DestroyMutex(board_mutex);
-	
-	board_mutex = SDL_CreateMutex();
-	srand(time(NULL));
-	
-	Session.score      = flush_nr = 0;
-	Session.score_mul  = 1;
-	Session.free_cells = BOARD_W * BOARD_H;
+	cl_snapshot s;
+	uint32_t w[SNAP_WORDS] = { 0 };
+	uint32_t seq;
+
+	if (e->snap.hold)
+		return;
+	memset(&s, 0, sizeof(s));
+	s.version = ++e->snap.version;
+	memcpy(s.desk, e->Session.desk, sizeof(s.desk));
+	for (int x = 0; x < POOL_SIZE; x++)
+		s.pool[x] = pool_cell(e, x);
+	for (int x = 0; x < BOARD_W; x++) {
+		for (int y = 0; y < BOARD_H; y++) {
+			cell_t m = e->move_matrix[x][y];
+			s.path[x][y] = (m & FL_PATH) ? (m & ~FL_PATH) + 1 : 0;
+		}
+	}
+	s.score     = board_score(e);
+	s.score_mul = board_score_mul(e);
+	if (!board_selected(e, &s.sel_x, &s.sel_y))
+		s.sel_x = s.sel_y = -1;
+	s.running = board_running(e);
+	memcpy(w, &s, sizeof(s));
+
+	seq = atomic_load_explicit(&e->snap.seq, memory_order_relaxed);
+	atomic_store_explicit(&e->snap.seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (int i = 0; i < SNAP_WORDS; i++)
+		atomic_store_explicit(&e->snap.word[i], w[i], memory_order_relaxed);
+	atomic_store_explicit(&e->snap.seq, seq + 2, memory_order_release);
+}
+
+void board_snapshot(cl_engine *e, cl_snapshot *s)
+{
+	uint32_t w[SNAP_WORDS];
+	uint32_t seq;
+
+	do {
+		seq = atomic_load_explicit(&e->snap.seq, memory_order_acquire);
+		for (int i = 0; i < SNAP_WORDS; i++)
+			w[i] = atomic_load_explicit(&e->snap.word[i], memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+	} while ((seq & 1) || seq != atomic_load_explicit(&e->snap.seq, memory_order_relaxed));
+	memcpy(s, w, sizeof(*s));
+}
+
+void board_init(cl_engine *e)
+{
+	bool on = e->ev.on;
+
+	e->ev.on = false; /* a new desk, nothing to play */
+	e->Session.score      = e->flush_nr = 0;
+	e->Session.score_mul  = 1;
+	e->Session.free_cells = BOARD_W * BOARD_H;
 	
-	memset(Session.desk,      0, sizeof(Session.desk));
-	memset(Session.ball_pool, 0, sizeof(Session.ball_pool));
-	memset(flushes,           0, sizeof(flushes));
-	memset(move_matrix,       0, sizeof(move_matrix));
-	memset(move_matrix_ids,   0, sizeof(move_matrix));
-
-	ball_x = ball_to_x = -1;
-	ball_y = ball_to_y = -1;
+	memset(e->Session.desk,      0, sizeof(e->Session.desk));
+	memset(e->Session.ball_pool, 0, sizeof(e->Session.ball_pool));
+	memset(e->move_matrix,       0, sizeof(e->move_matrix));
+	memset(e->move_matrix_ids,   0, sizeof(e->move_matrix));
+	free_sync(e);
+#ifdef BITBOARD
+	bits_sync(e);
+#endif
+
+	e->ball_x = e->ball_to_x = -1;
+	e->ball_y = e->ball_to_y = -1;
 	
-	board_fill_pool();
-	board_fill(NULL, NULL);
-	board_fill(NULL, NULL);
-	board_fill(NULL, NULL);
-	board_fill_pool();
+	board_fill_pool(e);
+	board_fill(e, NULL, NULL);
+	board_fill(e, NULL, NULL);
+	board_fill(e, NULL, NULL);
+	board_fill_pool(e);
+	dirty_clear(e);
+	e->reach.valid = false;
 	
-	board_state = IDLE;
+	e->board_state = IDLE;
+	e->ev.on = on;
+	board_publish(e);
 }
 
-cell_t board_cell(int x, int y)
+cell_t board_cell(cl_engine *e, int x, int y)
 {
-	cell_t cell;
-	board_lock();
-	cell = cell_get(x, y);
-	board_unlock();
-	return cell;
+	return cell_get(e, x, y);
 }
 
-cell_t pool_cell(int x)
+cell_t pool_cell(cl_engine *e, int x)
 {
-	cell_t cell;
-	board_lock();
-	cell = x < Session.iball || x >= POOL_SIZE ? 0 : Session.ball_pool[x];
-	board_unlock();
-	return cell;
+	return x < e->Session.iball || x >= POOL_SIZE ? 0 : e->Session.ball_pool[x];
 }
 
-static cell_t *cell_ref(int x, int y)
+static cell_t *cell_ref(cl_engine *e, int x, int y)
 {
 	if ((x < 0) || (x >= BOARD_W))
 		return NULL;
 	if ((y < 0) || (y >= BOARD_H))
 		return NULL;
-	return &Session.desk[x][y];
+	return &e->Session.desk[x][y];
 }
 
-static int mark_cell(int x, int y, cell_t n, int id)
+/* wave value at (x, y), 0 if off the board or left by another wave */
+static int wave_cell(const cell_t *m, const cell_t *ids, int x, int y, int id)
 {
-	cell_t new;
-	
-	if (!n)
-		return 0;
 	if (x < 0 || x >= BOARD_W)
 		return 0;
-		
 	if (y < 0 || y >= BOARD_H)
 		return 0;
-		
-	if (cell_get(x,y))
-		return 0;
-		
-	if (move_matrix[x][y] & FL_PATH)
+	if (ids && ids[x * BOARD_H + y] != id)
 		return 0;
-		
-	new = n + 1;
-	if (!move_matrix[x][y] || move_matrix[x][y] > new) {
-		move_matrix_ids[x][y] = id;
-		move_matrix[x][y] = new;
-	}
-	else
-		return 0;
-	return new;
+	return m[x * BOARD_H + y];
 }
 
-static int move_cell(int x, int y, int n, int id)
+static int move_cell(cl_engine *e, int x, int y, int id)
 {
-	if (x < 0 || x >= BOARD_W)
-		return 0;
-	if (y < 0 || y >= BOARD_H)
-		return 0;
-	if (move_matrix_ids[x][y] != id)
-		return 0;
-	return move_matrix[x][y];
+	return wave_cell(&e->move_matrix[0][0], &e->move_matrix_ids[0][0], x, y, id);
 }
 
 typedef struct {
@@ -201,83 +529,93 @@ typedef struct {
 	int n;
 } way_t;
 
-static void normalize_move_matrix(int x, int y, int tox, int toy, int id)
+/* one step from (x, y) back towards (tox, toy) along the wave m,
+ * keeping the last direction while it still leads there */
+static int wave_back(const cell_t *m, const cell_t *ids, int id, int tox, int toy,
+	int *ox, int *oy, int *onum, int last_move)
 {
 	int dx, dy, i;
-	int last_move = -1;
-	int num = move_matrix[x][y];
-	move_matrix[x][y] |= FL_PATH;
+	int x = *ox, y = *oy, num = *onum;
+	way_t w[4];
 	
-	do {
-		way_t w[4];
-		
-		int ways[4] = { 0, 1, 2, 3 };
-		
-		w[0].x = x + 1; w[1].x = x; w[0].y = y; w[1].y = y + 1; 
-		w[2].x = x - 1; w[3].x = x; w[2].y = y; w[3].y = y - 1;
-		
-		w[0].n = move_cell(x + 1, y, num, id);
-		w[1].n = move_cell(x, y + 1, num, id);
-		w[2].n = move_cell(x - 1, y, num, id);
-		w[3].n = move_cell(x, y - 1, num, id);
-		
-		dx = tox - x;
-		dy = toy - y;
-		
-		if (abs(dx) > abs(dy)) {
-			if (dy > 0) {
-				ways[0] = 1;
-				ways[1] = 3;
-			} else {
-				ways[0] = 3;
-				ways[1] = 1;
-			}
-			if (dx > 0) {
-				ways[2] = 0;
-				ways[3] = 2;
-			} else {
-				ways[2] = 2;
-				ways[3] = 0;
-			}	
+	int ways[4] = { 0, 1, 2, 3 };
+	
+	w[0].x = x + 1; w[1].x = x; w[0].y = y; w[1].y = y + 1; 
+	w[2].x = x - 1; w[3].x = x; w[2].y = y; w[3].y = y - 1;
+	
+	w[0].n = wave_cell(m, ids, x + 1, y, id);
+	w[1].n = wave_cell(m, ids, x, y + 1, id);
+	w[2].n = wave_cell(m, ids, x - 1, y, id);
+	w[3].n = wave_cell(m, ids, x, y - 1, id);
+	
+	dx = tox - x;
+	dy = toy - y;
+	
+	if (abs(dx) > abs(dy)) {
+		if (dy > 0) {
+			ways[0] = 1;
+			ways[1] = 3;
 		} else {
-			if (dx > 0) {
-				ways[0] = 0;
-				ways[1] = 2;
-			} else {
-				ways[0] = 2;
-				ways[1] = 0;
-			}
-			if (dy > 0) {
-				ways[2] = 1;
-				ways[3] = 3;
-			} else {
-				ways[2] = 3;
-				ways[3] = 1;
-			}
+			ways[0] = 3;
+			ways[1] = 1;
 		}
-		
-		if (last_move == -1 || w[last_move].n != num - 1) {
-			for (i = 0; i < 4; i++) {
-				if (w[ways[i]].n == num - 1) {
-					last_move = ways[i];
-					break;
-				}
+		if (dx > 0) {
+			ways[2] = 0;
+			ways[3] = 2;
+		} else {
+			ways[2] = 2;
+			ways[3] = 0;
+		}	
+	} else {
+		if (dx > 0) {
+			ways[0] = 0;
+			ways[1] = 2;
+		} else {
+			ways[0] = 2;
+			ways[1] = 0;
+		}
+		if (dy > 0) {
+			ways[2] = 1;
+			ways[3] = 3;
+		} else {
+			ways[2] = 3;
+			ways[3] = 1;
+		}
+	}
+	
+	if (last_move == -1 || w[last_move].n != num - 1) {
+		for (i = 0; i < 4; i++) {
+			if (w[ways[i]].n == num - 1) {
+				last_move = ways[i];
+				break;
 			}
 		}
-		
-		num = w[last_move].n;
-		x   = w[last_move].x;
-		y   = w[last_move].y;
-		
-		move_matrix[x][y] |= FL_PATH;
+	}
+	
+	*onum = w[last_move].n;
+	*ox   = w[last_move].x;
+	*oy   = w[last_move].y;
+	return last_move;
+}
+
+static void normalize_move_matrix(cl_engine *e, int x, int y, int tox, int toy, int id)
+{
+	int last_move = -1;
+	int num = e->move_matrix[x][y];
+	e->move_matrix[x][y] |= FL_PATH;
+	
+	do {
+		last_move = wave_back(&e->move_matrix[0][0], &e->move_matrix_ids[0][0], id,
+			tox, toy, &x, &y, &num, last_move);
+		e->move_matrix[x][y] |= FL_PATH;
 		
 	} while (num != 1);
 /*
 	fprintf(stdout,"XXX\n");
 	for (y = 0; y < BOARD_H; y ++) {
 		for (x = 0; x < BOARD_W; x ++) {
-			if (move_matrix[x][y] & FL_PATH)
-				fprintf(stdout, "%02d", move_matrix[x][y] & ~FL_PATH);
+			if (e->move_matrix[x][y] & FL_PATH)
+				fprintf(stdout, "%02d", e->move_matrix[x][y] & ~FL_PATH);
 			else	
 				fprintf(stdout, "..");
 		}
@@ -286,171 +624,197 @@ static void normalize_move_matrix(int x, int y, int tox, int toy, int id)
 */
 }
 
-static bool _board_path(int x, int y)
+static bool _board_path(cl_engine *e, int x, int y)
 {
 	if (x < 0 || x >= BOARD_W)
 		return false;
 	if (y < 0 || y >= BOARD_H)
 		return false;
-	if (move_matrix[x][y] & FL_PATH) {
+	if (e->move_matrix[x][y] & FL_PATH) {
 //		fprintf(stderr,"Stop\n");
 		return true;
 	}
 	return false;
 }
 
-bool board_path(int x, int y)
+bool board_path(cl_engine *e, int x, int y)
 {
-	bool rc;
-	board_lock();
-	rc = _board_path(x, y);
-	board_unlock();
-	return rc;
+	return _board_path(e, x, y);
 }
 
-void board_clear_path(int x, int y)
+void board_clear_path(cl_engine *e, int x, int y)
 {
-	board_lock();
-	move_matrix[x][y] = move_matrix[x][y] & ~FL_PATH;
-	board_unlock();
+	e->move_matrix[x][y] = e->move_matrix[x][y] & ~FL_PATH;
 }
 
-bool board_follow_path(int x, int y, int *ox, int *oy, int id)
+bool board_follow_path(cl_engine *e, int x, int y, int *ox, int *oy, int id)
 {
 	int num;
 	int a,v;
-	board_lock();
-	num  = move_matrix[x][y];
+	num  = e->move_matrix[x][y];
 	if (!(num & FL_PATH)) {
-		board_unlock();
 		return false;
 	}
 	num &= ~FL_PATH;
 	
-	a = move_cell(x + 1, y, num, id);
+	a = move_cell(e, x + 1, y, id);
 	v = a & ~FL_PATH;
 	if ((a & FL_PATH) && (v == num + 1)) {
 		*ox = x + 1; *oy = y;
-		board_unlock();
 		return true;
 	}
-	a = move_cell(x, y + 1, num, id);
+	a = move_cell(e, x, y + 1, id);
 	v = a & ~FL_PATH;
 	if ((a & FL_PATH) && (v == num + 1)) {
 		*ox = x; *oy = y + 1;
-		board_unlock();
 		return true;
 	}
-	a = move_cell(x -1 , y, num, id);
+	a = move_cell(e, x -1 , y, id);
 	v = a & ~FL_PATH;
 	if ((a & FL_PATH) && (v == num + 1)) {
 		*ox = x - 1; *oy = y;
-		board_unlock();
 		return true;
 	}
-	a = move_cell(x, y - 1, num, id);
+	a = move_cell(e, x, y - 1, id);
 	v = a & ~FL_PATH;
 	if ((a & FL_PATH) && (v == num + 1)) {
 		*ox = x; *oy = y - 1;
-		board_unlock();
 		return true;
 	}
-	board_unlock();
 //	fprintf(stderr,"No move %d:%d %d\n", id, x , y);
 	*ox = x;
 	*oy = y;
 	return false;
 }
 
-static bool board_move(int x1, int y1, int x2, int y2)
+/* Breadth-first wave from (x1, y1): every free cell gets its distance + 1,
+ * the same numbers the old relax-until-stable sweeps ended up with.
+ * Each cell is queued at most once, so the queue never wraps. */
+static void board_wave(cl_engine *e, cell_t *mm, cell_t *ids, int x1, int y1, int id)
+{
+	cell_t queue[BOARD_W * BOARD_H];
+	cell_t *desk = &e->Session.desk[0][0];
+	int head = 0, tail = 0;
+
+	queue[tail++] = x1 * BOARD_H + y1;
+	mm[queue[0]]  = 1;
+	if (ids)
+		ids[queue[0]] = id;
+
+	while (head != tail) {
+		int i = queue[head++];
+		cell_t n = mm[i] + 1;
+		for (int k = 0; k < e->neighbours[i].nr; k++) {
+			int j = e->neighbours[i].cell[k];
+			if (desk[j] || mm[j]) /* busy, seen or on a running path */
+				continue;
+			mm[j] = n;
+			if (ids)
+				ids[j] = id;
+			queue[tail++] = j;
+		}
+	}
+}
+
+static void ev_move(cl_engine *e, int x, int y, cell_t b, int id)
 {
-	int x, y, mark = 1;
+	cl_event *ev = ev_begin(e, CL_EV_MOVE, x, y, b);
+	if (!ev)
+		return;
+	e->ev.rec = NULL; /* the way is not a desk change */
+	do {
+		ev->cells[ev->nr].x    = x;
+		ev->cells[ev->nr].y    = y;
+		ev->cells[ev->nr].was  = 0;
+		ev->cells[ev->nr].ball = b;
+		ev->nr++;
+	} while (ev->nr < BOARD_W * BOARD_H && board_follow_path(e, x, y, &x, &y, id));
+	e->ev.rec = ev;
+	ev_end(e);
+}
+
+static bool board_move(cl_engine *e, int x1, int y1, int x2, int y2)
+{
+	int x, y;
 	int id = x1 + y1 * BOARD_W;
 	for (y = 0; y < BOARD_H; y++) {
 		for (x = 0; x < BOARD_W; x++) {
-			if (!(move_matrix[x][y] & FL_PATH)) {
-				move_matrix[x][y] = 0;
-				move_matrix_ids[x][y] = -1;
+			if (!(e->move_matrix[x][y] & FL_PATH)) {
+				e->move_matrix[x][y] = 0;
+				e->move_matrix_ids[x][y] = -1;
 			}
 		}
 	}
-//	memset(move_matrix, 0, sizeof(move_matrix));
-	if (move_matrix[x1][y1])
+//	memset(e->move_matrix, 0, sizeof(e->move_matrix));
+	if (e->move_matrix[x1][y1])
 		return false;
 //	fprintf(stderr,"%d %d	-> %d %d\n", x1, y1, x2, y2);
-	move_matrix[x1][y1] = 1;
-	move_matrix_ids[x1][y1] = id;
-	while (mark) {
-		mark = 0;
-		for (y = 0; y < BOARD_H; y++) {
-			for (x = 0; x < BOARD_W; x++) {
-				if (!move_matrix[x][y] || _board_path(x, y))
-					continue;
-				mark |= mark_cell(x - 1, y, move_matrix[x][y], id);
-				mark |= mark_cell(x + 1, y, move_matrix[x][y], id);
-				mark |= mark_cell(x, y - 1, move_matrix[x][y], id);
-				mark |= mark_cell(x, y + 1, move_matrix[x][y], id);
-			}
-		}
-	}
+	board_wave(e, &e->move_matrix[0][0], &e->move_matrix_ids[0][0], x1, y1, id);
 	
-//	fprintf(stdout,"XXX\n");
-//	for (y = 0; y < BOARD_H; y ++) {
-//		for (x = 0; x < BOARD_W; x ++) {
-//			if (move_matrix[x][y] & FL_PATH)
-//				fprintf(stdout, "XX");
-//			else
-//				fprintf(stdout, "%02d", move_matrix[x][y]);
-//		}
-//		fprintf(stdout,"\n");
-//	}
-	
-	if (!_board_path(x2, y2) && move_matrix[x2][y2]) {
+	if (!_board_path(e, x2, y2) && e->move_matrix[x2][y2]) {
 		cell_t b;
 		cell_t *c;
-		c = cell_ref(x1, y1);
+		c = cell_ref(e, x1, y1);
 		b = *c;
-		*c = 0;
-		c = cell_ref(x2, y2);
-		*c = b;
-		normalize_move_matrix(x2, y2, x1, y1, id);
+		cell_put(e, c, 0);
+		c = cell_ref(e, x2, y2);
+		cell_put(e, c, b);
+		normalize_move_matrix(e, x2, y2, x1, y1, id);
+		ev_move(e, x1, y1, b, id);
 		return true;
 	}
 	return false;
 }
 
-static cell_t *find_pos(int pos, int *ox, int *oy)
+static bool board_reach_update(cl_engine *e)
 {
-	int x, y;
-	for (y = 0; y < BOARD_H; y++) {
-		for (x = 0; x < BOARD_W; x++) {
-			cell_t *cell = cell_ref(x, y);
-			if (ox)
-				*ox = x;
-			if (oy)
-				*oy = y;	
-			if (*cell)
-				continue;
-			if (!pos)
-				return cell;
-			pos--;	
-		}
+	if (e->board_state != IDLE || !cell_get(e, e->ball_x, e->ball_y))
+		return false;
+	if (e->reach.valid && e->reach.x == e->ball_x && e->reach.y == e->ball_y)
+		return true;
+	memset(e->reach.dist, 0, sizeof(e->reach.dist));
+	board_wave(e, &e->reach.dist[0][0], NULL, e->ball_x, e->ball_y, 0);
+	e->reach.x = e->ball_x;
+	e->reach.y = e->ball_y;
+	e->reach.valid = true;
+	return true;
+}
+
+bool board_reach(cl_engine *e, cell_t dist[BOARD_W][BOARD_H])
+{
+	bool rc;
+	if ((rc = board_reach_update(e)))
+		memcpy(dist, e->reach.dist, sizeof(e->reach.dist));
+	return rc;
+}
+
+int board_preview(cl_engine *e, int x, int y, int *px, int *py)
+{
+	int nr = 0, num, last_move = -1;
+	if (board_reach_update(e) && (num = wave_cell(&e->reach.dist[0][0], NULL, x, y, 0)) > 1) {
+		do {
+			px[nr] = x;
+			py[nr] = y;
+			nr++;
+			last_move = wave_back(&e->reach.dist[0][0], NULL, 0,
+				e->reach.x, e->reach.y, &x, &y, &num, last_move);
+		} while (num != 1);
 	}
-	return NULL;
+	return nr;
 }
 
-static cell_t get_rand_cell(void)
+static cell_t get_rand_cell(cl_engine *e)
 {
 	cell_t c;
-	int rnd = rand() % 100;
+	int rnd = rng_next(e) % 100;
 	if (rnd < BONUS_PCNT)
-		return ball_joker + (rand() % BONUSES_NR);	
+		return ball_joker + (rng_next(e) % BONUSES_NR);	
 	c = (rnd % COLORS_NR) + 1;
 	return c;
 }
-static cell_t get_rand_color(void)
+static cell_t get_rand_color(cl_engine *e)
 {
-	return (rand() % 7) + 1;
+	return (rng_next(e) % 7) + 1;
 }
 
 static bool is_color(cell_t c)
@@ -462,6 +826,7 @@ static bool is_joker(cell_t c)
 	return (c == ball_joker || c == ball_bomb);
 }
 
+#ifdef LINE_SCANNERS
 static cell_t joinable(cell_t c, cell_t *prev)
 {
 	if (!c || !(*prev))
@@ -475,13 +840,11 @@ static cell_t joinable(cell_t c, cell_t *prev)
 	return 0;
 //	return ((a == b) || (a == ball_joker) || (b == ball_joker));
 }
+#endif
 
-static void flush_add(int x1, int y1, int x2, int y2, cell_t col)
+static void flush_add(cl_engine *e, int x1, int y1, int x2, int y2, cell_t col)
 {
-	flush_t *f;
-	f = malloc(sizeof(flush_t));
-	if (!f)
-		exit(1);
+	flush_t *f = &e->flushes[e->flush_nr++];
 	if (x2 > x1)
 		x2++;
 	if (y2 > y1)
@@ -493,7 +856,7 @@ static void flush_add(int x1, int y1, int x2, int y2, cell_t col)
 	f->col = col;
 	f->bomb = 0;
 	do {
-		if (cell_get(x1, y1) == ball_bomb)
+		if (cell_get(e, x1, y1) == ball_bomb)
 			f->bomb++;
 		f->cells[f->nr].x = x1;
 		f->cells[f->nr].y = y1;
@@ -506,78 +869,90 @@ static void flush_add(int x1, int y1, int x2, int y2, cell_t col)
 			y1 --;	
 	//	f->score ++;
 	} while ((x1 != x2) || (y1 != y2));
-	flushes[flush_nr ++] = f;
 }
 
-static bool remove_cell(cell_t *c)
+static bool remove_cell(cl_engine *e, cell_t *c)
 {
 	bool rc = false;
 	if (!*c)
 		return rc;
 	
 	if (is_color(*c) || is_joker(*c)) {
-		Session.score_delta++;
+		e->Session.score_delta++;
 		rc = true;
 	}
 	if (*c == ball_joker)
-		Session.score_mul *= 2;
-	*c = 0;
-	Session.free_cells++;
+		e->Session.score_mul *= 2;
+	cell_put(e, c, 0);
+	e->Session.free_cells++;
 	return rc;
 }
 
-static void remove_color(cell_t col)
+static void remove_color(cl_engine *e, cell_t col)
 {
 	int x, y;
 	for (y = 0; y < BOARD_H; y ++) {
 		for (x = 0; x < BOARD_W; x ++) {
-			cell_t *c = cell_ref(x, y);
+			cell_t *c = cell_ref(e, x, y);
 			if (*c == col) {
-				remove_cell(c);
+				remove_cell(e, c);
 			}
 		}
 	}
 }
 
-static bool flushes_remove(void)
+static bool flushes_remove(cl_engine *e)
 {
 	int i, k;
-	for (i = 0; i < flush_nr; i++) {
+	for (i = 0; i < e->flush_nr; i++) {
 		cell_t *c;
-		flush_t *f = flushes[i];
+		flush_t *f = &e->flushes[i];
+		ev_begin(e, CL_EV_LINE, f->cells[0].x, f->cells[0].y, f->col);
 		for (k = 0; k < f->nr; k++) {
 			if (f->bomb)
-				remove_color(f->col);
-			c = cell_ref(f->cells[k].x, f->cells[k].y);
+				remove_color(e, f->col);
+			c = cell_ref(e, f->cells[k].x, f->cells[k].y);
 			if (*c) {
 //				if (*c == ball_bomb) {
-//					remove_color(f->col);
+//					remove_color(e, f->col);
 //				}
-				remove_cell(c);
+				remove_cell(e, c);
 			}
 		}
-		free(f);
+		ev_end(e);
 	}
-	if (flush_nr) {
-		flush_nr = 0;
+	if (e->flush_nr) {
+		e->flush_nr = 0;
 		return true;
 	}
 	return false;
 }
 
-void board_fill_pool(void)
+void board_fill_pool(cl_engine *e)
 {
+	cl_event *ev;
 //	board_lock();
 	for (int i = 0; i < POOL_SIZE; i++) {
-		Session.ball_pool[i] = get_rand_cell(); //(rand() % (ball_max - 1)) + 1;
+		e->Session.ball_pool[i] = get_rand_cell(e); //(rand() % (ball_max - 1)) + 1;
 	}
-	Session.iball = 0;
+	e->Session.iball = 0;
 //	board_unlock();
+	if ((ev = ev_begin(e, CL_EV_POOL, -1, -1, 0))) {
+		for (int i = 0; i < POOL_SIZE; i++) {
+			ev->cells[i].x    = i;
+			ev->cells[i].y    = 0;
+			ev->cells[i].was  = 0;
+			ev->cells[i].ball = e->Session.ball_pool[i];
+		}
+		ev->nr = POOL_SIZE;
+		ev_end(e);
+	}
 }
 
-static int scan_hline(int x, int y)
+#ifdef LINE_SCANNERS
+static int scan_hline(cl_engine *e, int x, int y)
 {
-	while (x < BOARD_W && !cell_get(x, y)) // skip spaces
+	while (x < BOARD_W && !cell_get(e, x, y)) // skip spaces
 		x++;
 	
 	if ((BOARD_W - x) < BALLS_ROW)
@@ -585,9 +960,9 @@ static int scan_hline(int x, int y)
 	
 	int xi = x;
 	int yi = y;
-	cell_t b = cell_get(x, y);
+	cell_t b = cell_get(e, x, y);
 	
-	while (xi < BOARD_W && joinable(cell_get(xi, yi), &b))
+	while (xi < BOARD_W && joinable(cell_get(e, xi, yi), &b))
 		xi++;
 	
 	bool joker = is_joker(b); /* all jokers */
@@ -596,17 +971,17 @@ static int scan_hline(int x, int y)
 	//	fprintf(stderr, "~=/ Joker /=~\nstart: %d %d\nend: %d %d\n", x, y, xi, yi);
 	
 	if ((xi - x) >= BALLS_ROW) {
-		flush_add(x, y, xi - 1, y, b);
+		flush_add(e, x, y, xi - 1, y, b);
 	}
-	while (!joker && is_joker(cell_get(xi - 1, yi))) /* prepeare jokers for next try */
+	while (!joker && is_joker(cell_get(e, xi - 1, yi))) /* prepeare jokers for next try */
 		xi--;
 	
 	return xi;
 }
 
-static int scan_vline(int x, int y)
+static int scan_vline(cl_engine *e, int x, int y)
 {
-	while (y < BOARD_H && !cell_get(x, y)) // skip spaces
+	while (y < BOARD_H && !cell_get(e, x, y)) // skip spaces
 		y++;
 	
 	if ((BOARD_H - y) < BALLS_ROW)
@@ -614,26 +989,26 @@ static int scan_vline(int x, int y)
 	
 	int xi = x;
 	int yi = y;
-	cell_t b = cell_get(x, y);
+	cell_t b = cell_get(e, x, y);
 	
-	while (yi < BOARD_H && joinable(cell_get(xi, yi), &b))
+	while (yi < BOARD_H && joinable(cell_get(e, xi, yi), &b))
 		yi++;
 	
 	if ((yi - y) >= BALLS_ROW) {
-		flush_add(x, y, xi, yi - 1, b);
+		flush_add(e, x, y, xi, yi - 1, b);
 	}
 	
 	bool joker = is_joker(b); /* all jokers */
 	
-	while (!joker && is_joker(cell_get(xi, yi - 1))) /* prepeare jokers for next try */
+	while (!joker && is_joker(cell_get(e, xi, yi - 1))) /* prepeare jokers for next try */
 		yi--;
 	
 	return yi;
 }
 
-static int scan_aline(int x, int y) /* /  line */
+static int scan_aline(cl_engine *e, int x, int y) /* /  line */
 {
-	while (x < BOARD_W && y >= 0 && !cell_get(x, y)) { // skip spaces
+	while (x < BOARD_W && y >= 0 && !cell_get(e, x, y)) { // skip spaces
 		y--; x++;
 	}
 //	if (y < BALLS_ROW)
@@ -643,26 +1018,26 @@ static int scan_aline(int x, int y) /* /  line */
 	
 	int xi = x;
 	int yi = y;
-	cell_t b = cell_get(x, y);
+	cell_t b = cell_get(e, x, y);
 	
-	while (xi < BOARD_W && yi >= 0 && joinable(cell_get(xi, yi), &b)) {
+	while (xi < BOARD_W && yi >= 0 && joinable(cell_get(e, xi, yi), &b)) {
 		yi--; xi++;
 	}
 	if ((xi - x) >= BALLS_ROW) {
-		flush_add(x, y, xi - 1, yi + 1, b);
+		flush_add(e, x, y, xi - 1, yi + 1, b);
 	}
 	
 	bool joker = is_joker(b); /* all jokers */
 	
-	while (!joker && is_joker(cell_get(xi - 1, yi + 1))) { /* prepeare jokers for next try */
+	while (!joker && is_joker(cell_get(e, xi - 1, yi + 1))) { /* prepeare jokers for next try */
 		yi++; xi--;
 	}
 	return xi;
 }
 
-static int scan_bline(int x, int y) /* \  line */
+static int scan_bline(cl_engine *e, int x, int y) /* \  line */
 {
-	while (x < BOARD_W && y < BOARD_H && !cell_get(x, y)) { // skip spaces
+	while (x < BOARD_W && y < BOARD_H && !cell_get(e, x, y)) { // skip spaces
 		y++; x++;
 	}
 //	if ((BOARD_H - y) < BALLS_ROW)
@@ -672,229 +1047,442 @@ static int scan_bline(int x, int y) /* \  line */
 	
 	int xi = x;
 	int yi = y;
-	cell_t b = cell_get(x, y);
+	cell_t b = cell_get(e, x, y);
 	
-	while (xi < BOARD_W && yi < BOARD_H && joinable(cell_get(xi, yi), &b)) {
+	while (xi < BOARD_W && yi < BOARD_H && joinable(cell_get(e, xi, yi), &b)) {
 		yi++; xi++;
 	}
 	if ((xi - x) >= BALLS_ROW) {
-		flush_add(x, y, xi - 1, yi - 1, b);
+		flush_add(e, x, y, xi - 1, yi - 1, b);
 	}
 	
 	bool joker = is_joker(b); /* all jokers */
 	
-	while (!joker && is_joker(cell_get(xi - 1, yi - 1))) { /* prepeare jokers for next try */
+	while (!joker && is_joker(cell_get(e, xi - 1, yi - 1))) { /* prepeare jokers for next try */
 		yi--; xi--;
 	}
 	return xi;
 }
 
-static int board_check_hlines(void)
+static int board_check_hlines(cl_engine *e, unsigned int rows)
 {	
 	int x, y;
-	int of = flush_nr;
+	int of = e->flush_nr;
 	
 	for (y = 0; y < BOARD_H; y++ ) {
+		if (!(rows & (1u << y)))
+			continue;
 		for (x = 0; x < BOARD_W; ) {
-			x = scan_hline(x, y);
+			x = scan_hline(e, x, y);
 		}
 	}
-	return flush_nr - of;
+	return e->flush_nr - of;
 }
 
-static int board_check_vlines(void)
+static int board_check_vlines(cl_engine *e, unsigned int cols)
 {	
 	int x, y;
-	int of = flush_nr;
+	int of = e->flush_nr;
 	
 	for (x = 0; x < BOARD_W; x++ ) {
+		if (!(cols & (1u << x)))
+			continue;
 		for (y = 0; y < BOARD_H; ) {
-			y = scan_vline(x, y);
+			y = scan_vline(e, x, y);
 		}
 	}
-	return flush_nr - of;
+	return e->flush_nr - of;
 }
 
-static int board_check_alines(void)
+static int board_check_alines(cl_engine *e, unsigned int lines) /* by x + y */
 {	
 	int x, y;
-	int of = flush_nr;
+	int of = e->flush_nr;
 	for (y = 0; y < BOARD_H; y++ ) {
+		if (!(lines & (1u << y)))
+			continue;
 		for (x = 0; x < y; ) {
-			x = scan_aline(x, y - x);
+			x = scan_aline(e, x, y - x);
 		}
 	}
 	for (y = 1; y < BOARD_W; y++ ) {
+		if (!(lines & (1u << (y + BOARD_H - 1))))
+			continue;
 		for (x = y; x < BOARD_W; ) {
-			x = scan_aline(x, BOARD_H -1 - (x - y));
+			x = scan_aline(e, x, BOARD_H -1 - (x - y));
 		}
 	}
-	return flush_nr - of;
+	return e->flush_nr - of;
 }
 
-static int board_check_blines(void)
+static int board_check_blines(cl_engine *e, unsigned int lines) /* by x - y + BOARD_H - 1 */
 {	
 	int x, y;
-	int of = flush_nr;
+	int of = e->flush_nr;
 	for (y = 0; y < BOARD_W; y++ ) {
+		if (!(lines & (1u << (y + BOARD_H - 1))))
+			continue;
 		for (x = y; x < BOARD_W; ) {
-			x = scan_bline(x, x - y);
+			x = scan_bline(e, x, x - y);
 		}
 	}
 	for (y = 1; y < BOARD_H; y++ ) {
+		if (!(lines & (1u << (BOARD_H - 1 - y))))
+			continue;
 		for (x = 0; x < (BOARD_W - y); ) {
-			x = scan_bline(x, y + x);
+			x = scan_bline(e, x, y + x);
+		}
+	}
+	return e->flush_nr - of;
+}
+
+static int board_scan_lines(cl_engine *e) /* every line on the desk */
+{
+	return board_check_hlines(e, ~0u) + board_check_vlines(e, ~0u) +
+		board_check_alines(e, ~0u) + board_check_blines(e, ~0u);
+}
+#endif
+
+#ifdef BITBOARD
+/* Word-parallel line check. A line of colour c is a maximal run of
+ * (c | jokers) at least BALLS_ROW long with at least one real c in it;
+ * a run of jokers only counts when nothing follows it. This is exactly
+ * what the scan_*line() walkers find, jokers shared by two runs included. */
+
+#define BITS_H  1                       /* -  */
+#define BITS_V  BITS_STRIDE             /* |  */
+#define BITS_A  (-(BITS_STRIDE - 1))    /* /  */
+#define BITS_B  (BITS_STRIDE + 1)       /* \  */
+
+typedef struct {
+	int key;
+	int from, to;
+	cell_t col;
+} bits_run_t;
+
+static bits_t bits_next(bits_t m, int step, int n) /* cells whose n-th follower is in m */
+{
+	return step > 0 ? m >> (step * n) : m << (-step * n);
+}
+
+static bool bits_test(bits_t m, int i)
+{
+	return i >= 0 && i < 128 && ((m >> i) & 1);
+}
+
+static int bits_first(bits_t m)
+{
+	unsigned long long lo = (unsigned long long)m;
+	if (lo)
+		return __builtin_ctzll(lo);
+	return 64 + __builtin_ctzll((unsigned long long)(m >> 64));
+}
+
+static bits_t bits_spread(bits_t m, bits_t board, int step) /* whole lines through m */
+{
+	for (int n = 1; n < _max(BOARD_W, BOARD_H); n++)
+		m |= (bits_next(m, step, 1) | bits_next(m, -step, 1)) & board;
+	return m;
+}
+
+static bits_t bits_runs(bits_t m, int step) /* starts of runs >= BALLS_ROW */
+{
+	bits_t w = m & ~bits_next(m, -step, 1);
+	for (int n = 1; n < BALLS_ROW && w; n++)
+		w &= bits_next(m, step, n);
+	return w;
+}
+
+static int bits_key(int step, int x, int y) /* same order as the scanners */
+{
+	switch (step) {
+	case BITS_H:
+		return y * BOARD_W + x;
+	case BITS_V:
+		return x * BOARD_H + y;
+	case BITS_A:
+		return (x + y) * BOARD_W + x;
+	}
+	return (x >= y ? x - y : BOARD_W - 1 + y - x) * BOARD_W + x;
+}
+
+static int bits_run_add(bits_run_t *runs, int nr, int step, int from, int to, cell_t col)
+{
+	int i = nr;
+	int key = bits_key(step, from % BITS_STRIDE, from / BITS_STRIDE);
+	while (i > 0 && runs[i - 1].key > key) {
+		runs[i] = runs[i - 1];
+		i--;
+	}
+	runs[i].key  = key;
+	runs[i].from = from;
+	runs[i].to   = to;
+	runs[i].col  = col;
+	return nr + 1;
+}
+
+static int bits_check_dir(cl_engine *e, int step, bits_t lines)
+{
+	bits_run_t runs[BOARD_W * BOARD_H];
+	bits_t jokers = e->bits_mask[ball_joker] | e->bits_mask[ball_bomb];
+	bits_t busy = jokers;
+	bits_t m, s;
+	int c, i, end, nr = 0;
+	bool own;
+
+	for (c = 1; c < ball_max; c++) {
+		if (is_joker(c) || !e->bits_mask[c])
+			continue;
+		busy |= e->bits_mask[c];
+		m = e->bits_mask[c] | jokers;
+		for (s = bits_runs(m, step) & lines; s; s &= s - 1) {
+			end = i = bits_first(s);
+			own = bits_test(e->bits_mask[c], i);
+			while (bits_test(m, end + step)) {
+				end += step;
+				own |= bits_test(e->bits_mask[c], end);
+			}
+			if (own)
+				nr = bits_run_add(runs, nr, step, i, end, c);
 		}
 	}
-	return flush_nr - of;
+	for (s = bits_runs(jokers, step) & lines; s; s &= s - 1) { /* all jokers */
+		end = i = bits_first(s);
+		while (bits_test(jokers, end + step))
+			end += step;
+		if (!bits_test(busy, end + step))
+			nr = bits_run_add(runs, nr, step, i, end,
+				cell_get(e, end % BITS_STRIDE, end / BITS_STRIDE));
+	}
+	for (i = 0; i < nr; i++) {
+		flush_add(e, runs[i].from % BITS_STRIDE, runs[i].from / BITS_STRIDE,
+			runs[i].to % BITS_STRIDE, runs[i].to / BITS_STRIDE, runs[i].col);
+	}
+	return nr;
 }
 
-static int board_boom(int x, int y);
+static int bits_check(cl_engine *e, bits_t cells) /* lines through the cells only */
+{
+	bits_t board = 0;
+	for (int c = 0; c < ball_max; c++)
+		board |= e->bits_mask[c];
+	cells &= board;
+	return bits_check_dir(e, BITS_H, bits_spread(cells, board, BITS_H)) +
+		bits_check_dir(e, BITS_V, bits_spread(cells, board, BITS_V)) +
+		bits_check_dir(e, BITS_A, bits_spread(cells, board, BITS_A)) +
+		bits_check_dir(e, BITS_B, bits_spread(cells, board, BITS_B));
+}
+#endif
 
-static int boom_ball(int x, int y)
+/* Only a ball put on the desk can complete a line, and after REMOVE the
+ * desk holds none, so checking the lines through the cells touched since
+ * the last check finds the same flushes as scanning the whole desk. */
+static int board_check_lines(cl_engine *e, bool all)
+{
+	int rc;
+#ifdef BITBOARD
+	rc = bits_check(e, all ? ~(bits_t)0 : e->dirty_cells);
+#else
+	if (all)
+		rc = board_scan_lines(e);
+	else
+		rc = board_check_hlines(e, e->dirty_lines.h) + board_check_vlines(e, e->dirty_lines.v) +
+			board_check_alines(e, e->dirty_lines.a) + board_check_blines(e, e->dirty_lines.b);
+#endif
+	return rc;
+}
+
+#ifdef BOARD_DEBUG
+static bool flush_same(const flush_t *a, const flush_t *b)
+{
+	return a->nr == b->nr && a->col == b->col && a->bomb == b->bomb &&
+		!memcmp(a->cells, b->cells, a->nr * sizeof(a->cells[0]));
+}
+
+static void board_check_verify(cl_engine *e, int of) /* cross-check against a full scan */
+{
+	int i, nr = e->flush_nr - of;
+	int full = board_scan_lines(e);
+	bool same = (nr == full);
+	for (i = 0; same && i < nr; i++)
+		same = flush_same(&e->flushes[of + i], &e->flushes[of + nr + i]);
+	if (!same) {
+		fprintf(stderr, "board.c: incremental check found %d lines, full scan %d\n", nr, full);
+		board_display(e);
+	}
+	e->flush_nr = of + nr;
+}
+#endif
+
+static int board_boom(cl_engine *e, int x, int y);
+
+static int boom_ball(cl_engine *e, int x, int y)
 {
 	int rc = 0;
-	cell_t *c = cell_ref(x, y);
+	cell_t *c = cell_ref(e, x, y);
 	if (!c)
 		return 0;
 	if (*c == ball_boom) {
-		rc += board_boom(x, y);
-//		Session.score_delta ++;
+		rc += board_boom(e, x, y);
+//		e->Session.score_delta ++;
 	} else if (*c) {
-		rc += remove_cell(c);
+		rc += remove_cell(e, c);
 	}
 	return rc;
 }
 
-static int board_boom(int x, int y)
+static int board_boom(cl_engine *e, int x, int y)
 {
 	int rc = 0;
-	cell_t *c = cell_ref(x, y);
+	cell_t *c = cell_ref(e, x, y);
 	if (c && *c == ball_boom) {
-		*c = 0;
-		Session.free_cells ++;
-		c = cell_ref(x - 1, y);
+		cell_put(e, c, 0);
+		e->Session.free_cells ++;
+		c = cell_ref(e, x - 1, y);
 		if (c && *c)
-			rc += boom_ball(x - 1, y);
-		c = cell_ref(x + 1, y);
+			rc += boom_ball(e, x - 1, y);
+		c = cell_ref(e, x + 1, y);
 		if (c && *c)
-			rc += boom_ball(x + 1, y);
-		c = cell_ref(x, y - 1);
+			rc += boom_ball(e, x + 1, y);
+		c = cell_ref(e, x, y - 1);
 		if (c && *c)
-			rc += boom_ball(x, y - 1);
-		c = cell_ref(x, y + 1);
+			rc += boom_ball(e, x, y - 1);
+		c = cell_ref(e, x, y + 1);
 		if (c && *c)
-			rc += boom_ball(x, y + 1);
-		c = cell_ref(x + 1, y - 1);
+			rc += boom_ball(e, x, y + 1);
+		c = cell_ref(e, x + 1, y - 1);
 		if (c && *c)
-			rc += boom_ball(x + 1, y - 1);
-		c = cell_ref(x - 1, y - 1);
+			rc += boom_ball(e, x + 1, y - 1);
+		c = cell_ref(e, x - 1, y - 1);
 		if (c && *c)
-			rc += boom_ball(x - 1, y - 1);
-		c = cell_ref(x + 1, y + 1);
+			rc += boom_ball(e, x - 1, y - 1);
+		c = cell_ref(e, x + 1, y + 1);
 		if (c && *c)
-			rc += boom_ball(x + 1, y + 1);
-		c = cell_ref(x - 1, y + 1);
+			rc += boom_ball(e, x + 1, y + 1);
+		c = cell_ref(e, x - 1, y + 1);
 		if (c && *c)
-			rc += boom_ball(x - 1, y + 1);
+			rc += boom_ball(e, x - 1, y + 1);
 		return rc;	
 	}
 	return 0; 
 }
 
-static int board_paint(int x, int y)
+static int board_paint(cl_engine *e, int x, int y)
 {
 	int rc = 0;
 	
-	cell_t col = get_rand_color(); //TODO
-	cell_t *c = cell_ref(x, y);
+	cell_t col = get_rand_color(e); //TODO
+	cell_t *c = cell_ref(e, x, y);
 	if (c && *c == ball_brush) {
-		*c = 0;
-		Session.free_cells ++;
-		c = cell_ref(x - 1, y);
+		cell_put(e, c, 0);
+		e->Session.free_cells ++;
+		c = cell_ref(e, x - 1, y);
 		if (c && is_color(*c)) {
-			*c = col;
+			cell_put(e, c, col);
 			rc ++;
 		}
-		c = cell_ref(x + 1, y);
+		c = cell_ref(e, x + 1, y);
 		if (c && is_color(*c)) {
-			*c = col;
+			cell_put(e, c, col);
 			rc ++;
 		}
-		c = cell_ref(x, y - 1);
+		c = cell_ref(e, x, y - 1);
 		if (c && is_color(*c)) {
-			*c = col;
+			cell_put(e, c, col);
 			rc ++;
 		}
-		c = cell_ref(x, y + 1);
+		c = cell_ref(e, x, y + 1);
 		if (c && is_color(*c)) {
-			*c = col;
+			cell_put(e, c, col);
 			rc ++;
 		}
-		c = cell_ref(x + 1, y - 1);
+		c = cell_ref(e, x + 1, y - 1);
 		if (c && is_color(*c)) {
-			*c = col;
+			cell_put(e, c, col);
 			rc ++;
 		}
-		c = cell_ref(x - 1, y - 1);
+		c = cell_ref(e, x - 1, y - 1);
 		if (c && is_color(*c)) {
-			*c = col;
+			cell_put(e, c, col);
 			rc ++;
 		}
-		c = cell_ref(x + 1, y + 1);
+		c = cell_ref(e, x + 1, y + 1);
 		if (c && is_color(*c)) {
-			*c = col;
+			cell_put(e, c, col);
 			rc ++;
 		}
-		c = cell_ref(x - 1, y + 1);
+		c = cell_ref(e, x - 1, y + 1);
 		if (c && is_color(*c)) {
-			*c = col;
+			cell_put(e, c, col);
 			rc ++;
 		}
 		return rc;	
 	}
 	return 0; 
 }
-static int board_check(int x, int y)
+static int board_check(cl_engine *e, int x, int y)
 {
 	/* h line */
 	int rc;
-	rc = board_paint(x, y);
-	rc += board_boom(x, y);
-	return rc + board_check_hlines() + board_check_vlines() + board_check_alines() +
-		board_check_blines();
+#ifdef BOARD_DEBUG
+	int of = e->flush_nr;
+#endif
+	switch (cell_get(e, x, y)) {
+	case ball_brush:
+		ev_begin(e, CL_EV_PAINT, x, y, ball_brush);
+		break;
+	case ball_boom:
+		ev_begin(e, CL_EV_BOOM, x, y, ball_boom);
+		break;
+	}
+	rc = board_paint(e, x, y);
+	rc += board_boom(e, x, y);
+	ev_end(e);
+	rc += board_check_lines(e, false);
+#ifdef BOARD_DEBUG
+	board_check_verify(e, of);
+#endif
+	dirty_clear(e);
+	return rc;
 }
 
-bool board_fill(int *ox, int *oy)
+bool board_fill(cl_engine *e, int *ox, int *oy)
 {
 	int x, y;
 	int pos;
 	cell_t *cell;
+	cl_event *ev;
 
 //	board_lock();
-	if (Session.free_cells < 1) {
+	if (e->Session.free_cells < 1) {
 //		board_unlock();
 		return true;
 	}
 //	for (int i = 0; i < POOL_SIZE; i++) {
-		pos = rand() % Session.free_cells;
-		cell = find_pos(pos, &x, &y);
-		if (!cell) {
+		if (!e->free_nr) {
 			fprintf(stderr,"Something really bad 1\n");
 			exit(1);
 		}
-		*cell = Session.ball_pool[Session.iball++];
-		Session.free_cells--;
+		pos = e->free_cell[rng_next(e) % e->free_nr];
+		x = pos / BOARD_H;
+		y = pos % BOARD_H;
+		cell = cell_ref(e, x, y);
+		cell_put(e, cell, e->Session.ball_pool[e->Session.iball++]);
+		e->Session.free_cells--;
+		if ((ev = ev_begin(e, CL_EV_SPAWN, x, y, *cell))) {
+			ev->slot = e->Session.iball - 1;
+			ev_end(e);
+		}
 		if (ox)
 			*ox = x;
 		if (oy)
 			*oy = y;	
 //		board_check_row(x, y);
-//		flushes_remove();
+//		flushes_remove(e);
 //	}
 //	board_unlock();
-//	if (Session.iball == POOL_SIZE) {
-//		Session.iball = 0;
+//	if (e->Session.iball == POOL_SIZE) {
+//		e->Session.iball = 0;
 //		return false;
 //	}
 	return false;
@@ -913,23 +1501,22 @@ static void gfx_display_cell(int x, int y, cell_t cell)
 	}
 }
 
-void board_display(void)
+void board_display(cl_engine *e)
 {
 	int x, y;
 	for (y = 0; y < BOARD_H; y++) {
 		for (x = 0; x < BOARD_W; x++) {
-			gfx_display_cell(x, y, cell_get(x, y));		
+			gfx_display_cell(x, y, cell_get(e, x, y));		
 		}
 	}
 }
 
-bool board_select(int x, int y)
+bool board_select(cl_engine *e, int x, int y)
 {
 	if (x == -1 && y == -1) { /* special case */
-		board_lock();
-		ball_x = -1;
-		ball_y = -1;
-		board_unlock();	
+		e->ball_x = -1;
+		e->ball_y = -1;	
+		board_publish(e);
 		return false;
 	}
 	if (x < 0 || x >= BOARD_W)
@@ -938,180 +1525,243 @@ bool board_select(int x, int y)
 	if (y < 0 || y >= BOARD_H)
 		return false;
 		
-	board_lock();
 	
-//	if (board_state != IDLE) {
+//	if (e->board_state != IDLE) {
 //		board_unlock();
 //		return false;
 //	}
 	
-	cell_t *c = cell_ref(x, y);
+	cell_t *c = cell_ref(e, x, y);
 	
 	if (*c) {
-		ball_x = x;
-		ball_y = y;
-//		ball_to_x = -1;
-//		ball_to_y = -1;
-		board_unlock();
+		e->ball_x = x;
+		e->ball_y = y;
+		board_reach_update(e);
+		board_publish(e);
+//		e->ball_to_x = -1;
+//		e->ball_to_y = -1;
 		return false;
 	}
 	
-	if (!cell_get(ball_x, ball_y)) { /* nothing to move */
-		board_unlock();
+	if (!cell_get(e, e->ball_x, e->ball_y)) { /* nothing to move */
 		return false;
 	}
 
-	if (board_state != IDLE) {
-		board_unlock();
+	if (e->board_state != IDLE) {
 		return false;
 	}
 
-	ball_to_x = x;
-	ball_to_y = y;
-	board_state = MOVING;
+	e->ball_to_x = x;
+	e->ball_to_y = y;
+	e->board_state = MOVING;
 	
-//	if (!board_move(ball_x, ball_y, x, y)) {
+//	if (!board_move(e, e->ball_x, e->ball_y, x, y)) {
 //		board_unlock();
 //		return false;
 //	}
 //	board_check_row(x, y);
-//	if (flushes_remove()) {
+//	if (flushes_remove(e)) {
 //		board_unlock();
 //		return true;
 //	}
 	
-	board_unlock();
 	return true;
 }
 
-void board_logic(void)
+void board_logic(cl_engine *e)
 {
-	static bool rc;
-	static int x, y;
+	unsigned int state = e->board_state;
+	unsigned int score = e->Session.score, mul = e->Session.score_mul;
+	cl_event *ev;
 	bool fl;
-	board_lock();
-//	fprintf(stderr,"state=%d\n", board_state);
-	switch(board_state) {
+//	fprintf(stderr,"state=%d\n", e->board_state);
+	switch(e->board_state) {
 	case IDLE:
-		if (!Session.free_cells)
-			board_state = END;
-		else if (Session.free_cells == (BOARD_W * BOARD_H))
-			board_state = FILL_BOARD;
+		if (!e->Session.free_cells)
+			e->board_state = END;
+		else if (e->Session.free_cells == (BOARD_W * BOARD_H))
+			e->board_state = FILL_BOARD;
 		break;
 	case MOVING:
-		if ((rc = board_move(ball_x, ball_y, ball_to_x, ball_to_y))) {
-			board_state = CHECK;
-//			x = ball_to_x;
-//			y = ball_to_y;
-			ball_x = -1;
-			ball_y = -1;
+		if ((e->logic.rc = board_move(e, e->ball_x, e->ball_y, e->ball_to_x, e->ball_to_y))) {
+			e->board_state = CHECK;
+//			e->logic.x = e->ball_to_x;
+//			e->logic.y = e->ball_to_y;
+			e->ball_x = -1;
+			e->ball_y = -1;
 		} else
-			board_state = IDLE;
+			e->board_state = IDLE;
 		break;
 	case FILL_POOL:
-		board_fill_pool();
-		board_state = (Session.free_cells == BOARD_W * BOARD_H) ? FILL_BOARD : IDLE;
-//		Session.score_mul = 1;
+		board_fill_pool(e);
+		e->board_state = (e->Session.free_cells == BOARD_W * BOARD_H) ? FILL_BOARD : IDLE;
+//		e->Session.score_mul = 1;
 		break;
 	case FILL_BOARD:
-		board_state = (rc = board_fill(&x, &y)) ? END : CHECK;
-//		Session.score_mul = 1; /* multiply == 1 */	
+		e->board_state = (e->logic.rc = board_fill(e, &e->logic.x, &e->logic.y)) ? END : CHECK;
+//		e->Session.score_mul = 1; /* multiply == 1 */	
 		break;
 	case CHECK:
-		if (rc) {
-			Session.score_mul = 1;
-			x = ball_to_x;// = -1;
-			y = ball_to_y;// = -1;
+		if (e->logic.rc) {
+			e->Session.score_mul = 1;
+			e->logic.x = e->ball_to_x;// = -1;
+			e->logic.y = e->ball_to_y;// = -1;
 		} else {
-			x = -1;
-			y = -1;
+			e->logic.x = -1;
+			e->logic.y = -1;
 		}
-		Session.score_delta = 0;
-		ball_to_x  = -1;
-		ball_to_y  = -1;
-		if (board_check(x, y))
-			board_state = REMOVE;
-		else if (rc || (POOL_SIZE - Session.iball) > 0)
-			board_state = FILL_BOARD;
+		e->Session.score_delta = 0;
+		e->ball_to_x  = -1;
+		e->ball_to_y  = -1;
+		if (board_check(e, e->logic.x, e->logic.y))
+			e->board_state = REMOVE;
+		else if (e->logic.rc || (POOL_SIZE - e->Session.iball) > 0)
+			e->board_state = FILL_BOARD;
 		else
-			board_state = FILL_POOL;
+			e->board_state = FILL_POOL;
 		break;
 	case REMOVE:
-		fl = flushes_remove();
-		Session.score += Session.score_delta * Session.score_mul;
+		fl = flushes_remove(e);
+		e->Session.score += e->Session.score_delta * e->Session.score_mul;
 		if (fl)
-			Session.score_mul++;
-//		fprintf(stderr, "Score: %d (+%d * %d)\n", Session.score, Session.score_delta, Session.score_mul);
-//		show_score(Session.score);
-		if (rc)
-			board_state = IDLE;
-		else if ((POOL_SIZE - Session.iball) > 0)
-			board_state = FILL_BOARD;
+			e->Session.score_mul++;
+//		fprintf(stderr, "Score: %d (+%d * %d)\n", e->Session.score, e->Session.score_delta, e->Session.score_mul);
+//		show_score(e->Session.score);
+		if (e->logic.rc)
+			e->board_state = IDLE;
+		else if ((POOL_SIZE - e->Session.iball) > 0)
+			e->board_state = FILL_BOARD;
 		else
-			board_state = FILL_POOL;
+			e->board_state = FILL_POOL;
 		break;
 	case END:
 //		fprintf(stderr, "Game Over\n");
 		break;
 	}
-	board_unlock();
+	if ((score != e->Session.score || mul != e->Session.score_mul) &&
+	    (ev = ev_begin(e, CL_EV_SCORE, -1, -1, 0))) {
+		ev->score     = board_score(e);
+		ev->score_mul = board_score_mul(e);
+		ev_end(e);
+	}
+	if (e->board_state == END && state != END && ev_begin(e, CL_EV_OVER, -1, -1, 0))
+		ev_end(e);
+	if (e->board_state != state)
+		board_publish(e);
+}
+
+bool board_waiting(cl_engine *e)
+{
+	return e->board_state == END || (e->board_state == IDLE &&
+		e->Session.free_cells && e->Session.free_cells != BOARD_W * BOARD_H);
+}
+
+/* Headless turn: the same steps the GUI takes between its animations,
+ * run back to back until the board waits for the next move. */
+bool board_play(cl_engine *e, int x1, int y1, int x2, int y2, cl_turn *t)
+{
+	unsigned int score = e->Session.score;
+	unsigned int state, free_cells;
+
+	memset(t, 0, sizeof(*t));
+	e->snap.hold = true;
+	while (!board_waiting(e))
+		board_logic(e);
+
+	if (e->board_state == IDLE && cell_get(e, x1, y1) && !cell_get(e, x2, y2) &&
+	    x2 >= 0 && x2 < BOARD_W && y2 >= 0 && y2 < BOARD_H) {
+		board_select(e, x1, y1);
+		board_select(e, x2, y2);
+		do {
+			state = e->board_state;
+			free_cells = e->Session.free_cells;
+			if (state == REMOVE)
+				t->lines += e->flush_nr;
+			board_logic(e);
+			switch (state) {
+			case MOVING:
+				t->moved = (e->board_state == CHECK);
+				memset(e->move_matrix, 0, sizeof(e->move_matrix)); /* no one walks the path */
+				break;
+			case FILL_BOARD:
+				if (e->board_state == END || t->placed_nr == BOARD_W * BOARD_H)
+					break;
+				t->placed[t->placed_nr].x = e->logic.x;
+				t->placed[t->placed_nr].y = e->logic.y;
+				t->placed[t->placed_nr].ball = cell_get(e, e->logic.x, e->logic.y);
+				t->placed_nr++;
+				break;
+			case CHECK: /* bombs and booms go off here */
+			case REMOVE:
+				t->cleared += e->Session.free_cells - free_cells;
+				break;
+			}
+		} while (!board_waiting(e));
+	}
+	t->over  = !board_running(e);
+	t->score = e->Session.score - score;
+	e->snap.hold = false;
+	board_publish(e);
+	return !t->moved;
 }
 
-int board_score()
+int board_score(cl_engine *e)
 {
-	int s;
-	board_lock();
-	s = Session.score;
-	board_unlock();
-	return s;
+	return e->Session.score;
 }
 
-int board_score_mul()
+int board_score_mul(cl_engine *e)
 {
-	int s;
-	board_lock();
-	s = Session.score_mul - 1;
-	board_unlock();
-	return s;
+	return e->Session.score_mul - 1;
 }
 
-bool board_running(void)
+bool board_running(cl_engine *e)
 {
-	return board_state != END;
+	return e->board_state != END;
 }
 
-bool board_save(const char *path)
+bool board_save(cl_engine *e, const char *path)
 {
 	FILE * file = fopen(path, "wb");
 	
 	if (file == NULL)
 		return true;
 	
-	while ((board_state != IDLE) && board_running())
-		board_logic();
+	while ((e->board_state != IDLE) && board_running(e))
+		board_logic(e);
 	
-	if (!board_running())
+	if (!board_running(e))
 		return true;
 	
-	board_lock();
-	fwrite(&Session, sizeof(struct __SESS__), 1, file);
-	board_unlock();
+	fwrite(&e->Session, sizeof(struct __SESS__), 1, file);
+	fwrite(&e->rng, sizeof(struct __RNG__), 1, file);
 	fclose(file);
 	
 	return false;
 }
 
-bool board_load(const char *path)
+bool board_load(cl_engine *e, const char *path)
 {
+	struct __RNG__ rng;
 	FILE * file = fopen(path, "rb");
 
 	if (file == NULL)
 		return true;
 
-	board_lock();
-	fread(&Session, sizeof(struct __SESS__), 1, file);
-	board_state = IDLE;
-	board_unlock();
+	fread(&e->Session, sizeof(struct __SESS__), 1, file);
+	if (fread(&rng, sizeof(struct __RNG__), 1, file) == 1)
+		e->rng = rng;
+	free_sync(e);
+	e->flush_nr = 0;
+	e->ball_x = e->ball_to_x = -1;
+	e->ball_y = e->ball_to_y = -1;
+#ifdef BITBOARD
+	bits_sync(e);
+#endif
+	dirty_clear(e);
+	e->reach.valid = false;
+	e->board_state = IDLE;
+	board_publish(e);
 	fclose(file);
 
 	return false;
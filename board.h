@@ -1,6 +1,9 @@
 #ifndef __BOARD_H
 #define __BOARD_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #define BOARD_W 9
 #define BOARD_H 9
 #define POOL_SIZE 3
@@ -25,24 +28,92 @@ extern enum {
 #define BONUSES_NR 4
 typedef unsigned char cell_t;
 
-extern void board_init(void);
-extern bool board_fill(int *x, int *y); /* calls gfx_fill_cell, gfx_clear_pool */
-extern void board_display(void); /* calls gfx_display_board */
-extern void board_fill_pool(void); /* calls gfx_fill_pool */
-extern bool board_select(int x, int y); /* calls gfx_select_ball, gfx_move, gfx_clean_cell */
-extern cell_t board_cell(int x, int y);
-extern void board_time_update(int sec);
-extern bool board_selected(int *x, int *y);
-extern bool board_moved(int *x, int *y);
-extern void board_logic(void);
-extern bool board_follow_path(int x, int y, int *ox, int *oy, int id);
-extern bool board_path(int x, int y);
-extern void board_clear_path(int x, int y);
-extern cell_t pool_cell(int x);
-extern int board_time(void);
-extern int board_score(void);
-extern int board_score_mul(void);
-extern bool board_running(void);
-extern bool board_load(const char *path);
-extern bool board_save(const char *path);
+/* One game. Engines share nothing, so any number of them can run at once,
+ * but a single engine must only be used by one thread at a time. */
+typedef struct cl_engine cl_engine;
+
+/* what one board_play() turn did */
+typedef struct {
+	bool moved;          /* false if there was no way */
+	bool over;           /* no room left */
+	int lines;           /* lines removed */
+	int cleared;         /* cells emptied by lines, bombs and booms */
+	int score;           /* points gained */
+	int placed_nr;
+	struct {
+		cell_t x, y, ball;
+	} placed[BOARD_W * BOARD_H]; /* spawned balls, in order */
+} cl_turn;
+
+/* What a renderer draws, published by the engine on every change it can
+ * see. board_snapshot() may run on any thread while another one drives the
+ * engine: it takes no lock and only retries if a publish overlapped. */
+typedef struct {
+	unsigned int version;          /* goes up with every publish */
+	cell_t desk[BOARD_W][BOARD_H];
+	cell_t pool[POOL_SIZE];        /* as pool_cell() */
+	cell_t path[BOARD_W][BOARD_H]; /* step + 1 on the moving ball's way, as of the move */
+	int score, score_mul;          /* as board_score(), board_score_mul() */
+	int sel_x, sel_y;              /* selected ball, -1 if none */
+	bool running;
+} cl_snapshot;
+
+/* What the engine did, step by step, once board_events() is on. The engine's
+ * thread queues them and one other thread may take them off in order with
+ * board_event() and board_event_done(), no lock on either side. */
+enum {
+	CL_EV_SPAWN = 1, /* ball from pool slot to x, y */
+	CL_EV_POOL,      /* new pool, ball of each slot in cells[] */
+	CL_EV_MOVE,      /* ball from x, y along cells[], start to destination */
+	CL_EV_LINE,      /* a line of ball went out, cells[] emptied */
+	CL_EV_BOOM,      /* boom at x, y, cells[] emptied */
+	CL_EV_PAINT,     /* brush at x, y, cells[] emptied or painted */
+	CL_EV_SCORE,     /* score and score_mul, as board_score(), board_score_mul() */
+	CL_EV_OVER,      /* no room left */
+};
+
+typedef struct {
+	int type;
+	int x, y;
+	cell_t ball;
+	int slot;
+	int score, score_mul;
+	int nr;
+	struct {
+		cell_t x, y, was, ball;
+	} cells[BOARD_W * BOARD_H];
+} cl_event;
+
+extern cl_engine *board_new(void); /* NULL on out of memory, board_init() or board_load() it next */
+extern void board_free(cl_engine *e);
+extern void board_seed(cl_engine *e, uint64_t seed); /* same seed, same game from the next board_init() */
+extern uint64_t board_get_seed(cl_engine *e);
+
+extern void board_init(cl_engine *e);
+extern bool board_fill(cl_engine *e, int *x, int *y); /* calls gfx_fill_cell, gfx_clear_pool */
+extern void board_display(cl_engine *e); /* calls gfx_display_board */
+extern void board_fill_pool(cl_engine *e); /* calls gfx_fill_pool */
+extern bool board_select(cl_engine *e, int x, int y); /* calls gfx_select_ball, gfx_move, gfx_clean_cell */
+extern cell_t board_cell(cl_engine *e, int x, int y);
+extern bool board_selected(cl_engine *e, int *x, int *y);
+extern bool board_moved(cl_engine *e, int *x, int *y);
+extern void board_logic(cl_engine *e);
+extern bool board_play(cl_engine *e, int x1, int y1, int x2, int y2, cl_turn *t); /* whole turn at once, true if nothing moved */
+extern bool board_waiting(cl_engine *e); /* board_logic() does nothing until the next move */
+extern bool board_follow_path(cl_engine *e, int x, int y, int *ox, int *oy, int id);
+extern bool board_path(cl_engine *e, int x, int y);
+extern void board_clear_path(cl_engine *e, int x, int y);
+extern bool board_reach(cl_engine *e, cell_t dist[BOARD_W][BOARD_H]); /* steps + 1 from the selected ball, 0 if out of reach */
+extern int board_preview(cl_engine *e, int x, int y, int *px, int *py); /* the way the selected ball would go to x, y */
+extern cell_t pool_cell(cl_engine *e, int x);
+extern void board_snapshot(cl_engine *e, cl_snapshot *s);
+extern void board_events(cl_engine *e, bool on); /* off after board_new(), before any other thread reads */
+extern const cl_event *board_event(cl_engine *e); /* oldest one not done, NULL if none */
+extern void board_event_done(cl_engine *e);
+extern bool board_events_lost(cl_engine *e); /* true once after the queue was full and some were dropped */
+extern int board_score(cl_engine *e);
+extern int board_score_mul(cl_engine *e);
+extern bool board_running(cl_engine *e);
+extern bool board_load(cl_engine *e, const char *path);
+extern bool board_save(cl_engine *e, const char *path);
 #endif
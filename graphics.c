@@ -4,12 +4,64 @@
 #include "graphics.h"
 #include "math.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 
 static SDL_Window *sdlWindow;
 static SDL_Renderer *sdlRenderer;
 static SDL_Texture *sdlTexture;
 static SDL_Surface *screen;
 
+/* images are kept in the screen's own format, so blits never convert */
+#define GFX_FORMAT (screen->format->format)
+
+/* Parts of screen drawn since the last gfx_update(), only these go to the
+ * texture. */
+#define DAMAGE_MAX 16
+
+static struct {
+	int nr;
+	SDL_Rect rect[DAMAGE_MAX];
+} damage;
+
+static int rect_area(const SDL_Rect *r)
+{
+	return r->w * r->h;
+}
+
+static void gfx_damage(const SDL_Rect *r)
+{
+	SDL_Rect all = { 0, 0, SCREEN_W, SCREEN_H };
+	SDL_Rect d, u;
+	int i, best = 0, grow = INT_MAX;
+
+	if (!SDL_IntersectRect(r, &all, &d))
+		return;
+	for (i = 0; i < damage.nr; i++) {
+		SDL_UnionRect(&damage.rect[i], &d, &u);
+		if (rect_area(&u) <= rect_area(&damage.rect[i]) + rect_area(&d))
+			break; /* overlapping or side by side */
+		if (rect_area(&u) - rect_area(&damage.rect[i]) < grow) {
+			grow = rect_area(&u) - rect_area(&damage.rect[i]);
+			best = i;
+		}
+	}
+	if (i < damage.nr)
+		damage.rect[i] = u;
+	else if (damage.nr < DAMAGE_MAX)
+		damage.rect[damage.nr++] = d;
+	else
+		SDL_UnionRect(&damage.rect[best], &d, &damage.rect[best]);
+}
+
+void gfx_expose(void)
+{
+	SDL_Rect all = { 0, 0, SCREEN_W, SCREEN_H };
+	gfx_damage(&all);
+}
+
 void gfx_free_image(img_t p)
 {
 	SDL_FreeSurface((SDL_Surface *)p);
@@ -25,11 +77,21 @@ int	gfx_img_h(img_t pixmap)
 	return pixmap ? ((SDL_Surface *)pixmap)->h : 0;
 }
 
+/* opaque, so drawing it is a plain copy */
+img_t gfx_new_screen_image(int w, int h)
+{
+	SDL_Surface *img;
+	if (!(img = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, GFX_FORMAT)))
+		return NULL;
+	SDL_SetSurfaceBlendMode(img, SDL_BLENDMODE_NONE);
+	return img;
+}
+
 img_t gfx_grab_screen(int x, int y, int w, int h)
 {
 	SDL_Rect dest, src;
 	SDL_Surface * img;
-	if (!(img = SDL_CreateRGBSurface(0, w, h, 16, 0xF800, 0x7E0, 0x1F, 0)))
+	if (!(img = gfx_new_screen_image(w, h)))
 		return NULL;
 	src.x = x; dest.x = 0;
 	src.y = y; dest.y = 0;
@@ -43,7 +105,7 @@ img_t gfx_set_alpha(img_t src, int alpha)
 {
 	SDL_Surface * img;
 
-	if (!(img = SDL_ConvertSurfaceFormat((SDL_Surface*)src, SDL_PIXELFORMAT_RGBA8888, 0)))
+	if (!(img = SDL_ConvertSurfaceFormat((SDL_Surface*)src, GFX_FORMAT, 0)))
 		return NULL;
 	
 	Uint32 *ptr = (Uint32*)img->pixels;
@@ -58,10 +120,19 @@ img_t gfx_set_alpha(img_t src, int alpha)
 	return img;
 }
 
+img_t gfx_new_image(int w, int h, int r, int g, int b, int a)
+{
+	SDL_Surface * img;
+	if (!(img = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, GFX_FORMAT)))
+		return NULL;
+	SDL_FillRect(img, NULL, SDL_MapRGBA(img->format, r, g, b, a));
+	return img;
+}
+
 img_t gfx_combine(img_t src, img_t dst)
 {
 	SDL_Surface * new;
-	if (!(new = SDL_ConvertSurfaceFormat(dst, SDL_PIXELFORMAT_RGBA8888, 0)))
+	if (!(new = SDL_ConvertSurfaceFormat(dst, GFX_FORMAT, 0)))
 		return NULL;
 	SDL_BlitSurface((SDL_Surface *)src, NULL, new, NULL);
 	return new;
@@ -81,21 +152,152 @@ img_t gfx_load_image(const char *file, bool alpha)
 		fprintf(stderr, "graphics.c: File not found - '%s'\n", path);
 		return NULL;
 	}
-	if (alpha) {
+	if (alpha)
 		SDL_SetColorKey(img, SDL_HasColorKey(img), img->format->format);
-		return img;
-	}
-	// Create hardware surface
-	if (!(surf = SDL_CreateRGBSurface(0, img->w, img->h, 16, 0xF800, 0x7E0, 0x1F, 0))) {
+	// Convert to the screen format, opaque images are then drawn by copy
+	if (!(surf = SDL_ConvertSurfaceFormat(img, GFX_FORMAT, 0))) {
 		SDL_FreeSurface(img);
 		fprintf(stderr, "graphics.c: Error creating surface!\n");
 		return NULL;
 	}
-	SDL_BlitSurface(img, NULL, surf, NULL);
 	SDL_FreeSurface(img);
+	if (!alpha)
+		SDL_SetSurfaceBlendMode(surf, SDL_BLENDMODE_NONE);
 	return surf;
 }
 
+/*
+*  Image cache: generated images go to one file, which is mapped on the
+*  next start and used in place. Bump CACHE_VERSION when the file layout
+*  or the way images are made changes.
+*/
+#define CACHE_MAGIC   0x434C4331 /* CLC1 */
+#define CACHE_VERSION 2
+#define CACHE_ALIGN   64
+
+typedef struct {
+	Uint32 magic, version;
+	uint64_t key;
+	Uint32 nr, pad;
+} cache_head_t;
+
+typedef struct {
+	Uint32 format;
+	Sint32 w, h, pitch;
+	uint64_t offset;
+} cache_img_t;
+
+/* the surfaces from gfx_cache_load() point in here until gfx_done() */
+static void *cache_map;
+static size_t cache_size;
+
+uint64_t gfx_cache_key(uint64_t key, const void *data, size_t size)
+{
+	const Uint8 *p = data;
+	key ^= 0xCBF29CE484222325ULL; /* FNV-1a */
+	while (size--) {
+		key ^= *p++;
+		key *= 0x100000001B3ULL;
+	}
+	return key;
+}
+
+uint64_t gfx_cache_file(uint64_t key, const char *file)
+{
+	char path[ PATH_MAX ];
+	struct stat st;
+	int64_t stamp[2] = { -1, -1 };
+
+	snprintf(path, sizeof(path), "%sgfx/%s", GAME_DIR, file);
+	if (!stat(path, &st)) {
+		stamp[0] = st.st_mtime;
+		stamp[1] = st.st_size;
+	}
+	return gfx_cache_key(key, stamp, sizeof(stamp));
+}
+
+bool gfx_cache_load(const char *path, uint64_t key, img_t **imgs, int nr)
+{
+	const cache_head_t *head;
+	const cache_img_t *ci;
+	struct stat st;
+	Uint8 *map;
+	int fd, i = 0;
+
+	if (cache_map || (fd = open(path, O_RDONLY)) < 0)
+		return true;
+	if (fstat(fd, &st) || st.st_size < (off_t)(sizeof(*head) + nr * sizeof(*ci))) {
+		close(fd);
+		return true;
+	}
+	/* private, so a stray write never reaches the file */
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return true;
+	head = (const cache_head_t *)map;
+	ci = (const cache_img_t *)(head + 1);
+	if (head->magic != CACHE_MAGIC || head->version != CACHE_VERSION ||
+	    head->key != key || head->nr != (Uint32)nr)
+		goto err;
+	for (i = 0; i < nr; i++, ci++) {
+		if (ci->w <= 0 || ci->h <= 0 || ci->pitch < ci->w * SDL_BYTESPERPIXEL(ci->format) ||
+		    ci->offset % CACHE_ALIGN || ci->offset + (uint64_t)ci->pitch * ci->h > (uint64_t)st.st_size)
+			goto err;
+		*imgs[i] = SDL_CreateRGBSurfaceWithFormatFrom(map + ci->offset, ci->w, ci->h,
+			SDL_BITSPERPIXEL(ci->format), ci->pitch, ci->format);
+		if (!*imgs[i])
+			goto err;
+	}
+	cache_map = map;
+	cache_size = st.st_size;
+	return false;
+err:
+	while (i-- > 0) {
+		SDL_FreeSurface(*imgs[i]);
+		*imgs[i] = NULL;
+	}
+	munmap(map, st.st_size);
+	return true;
+}
+
+bool gfx_cache_save(const char *path, uint64_t key, img_t **imgs, int nr)
+{
+	char tmp[ PATH_MAX ];
+	cache_head_t head = { CACHE_MAGIC, CACHE_VERSION, key, nr, 0 };
+	uint64_t offset = sizeof(head) + nr * sizeof(cache_img_t);
+	bool err = false;
+	FILE *f;
+	int i;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if (!(f = fopen(tmp, "wb")))
+		return true;
+	err |= fwrite(&head, sizeof(head), 1, f) != 1;
+	for (i = 0; i < nr; i++) {
+		SDL_Surface *s = *imgs[i];
+		cache_img_t ci = { s->format->format, s->w, s->h, s->pitch, 0 };
+		offset = (offset + CACHE_ALIGN - 1) / CACHE_ALIGN * CACHE_ALIGN;
+		ci.offset = offset;
+		offset += (uint64_t)s->pitch * s->h;
+		err |= fwrite(&ci, sizeof(ci), 1, f) != 1;
+	}
+	offset = sizeof(head) + nr * sizeof(cache_img_t);
+	for (i = 0; i < nr && !err; i++) {
+		SDL_Surface *s = *imgs[i];
+		offset = (offset + CACHE_ALIGN - 1) / CACHE_ALIGN * CACHE_ALIGN;
+		err |= fseek(f, offset, SEEK_SET) != 0;
+		err |= fwrite(s->pixels, s->pitch, s->h, f) != (size_t)s->h;
+		offset += (uint64_t)s->pitch * s->h;
+	}
+	err |= fclose(f) != 0;
+	if (err || rename(tmp, path)) {
+		remove(tmp);
+		return true;
+	}
+	return false;
+}
+
 typedef struct {
 	img_t font;
 	int	w, h, n;
@@ -124,10 +326,111 @@ static int fnt_calc_idx(int n, char c)
 	return (idx - 0x20 - 1);
 }
 
-int gfx_draw_char(const char c, int x, int y, float s)
+/*
+*  Scaled glyphs are drawn once into a shared atlas and blitted from there.
+*  Keyed by glyph and scale; when the atlas or the table fills up it starts
+*  over empty.
+*/
+#define GLYPH_ATLAS_W 512
+#define GLYPH_ATLAS_H 128
+#define GLYPH_SLOTS   128
+
+static struct {
+	SDL_Surface *atlas;
+	int x, y, row_h; /* next free spot, tallest glyph on this row */
+	int nr;
+	struct {
+		bool used;
+		int idx;
+		float s;
+		SDL_Rect r;
+	} slot[GLYPH_SLOTS];
+	unsigned hits, misses;
+} glyphs;
+
+static void glyph_reset(void)
 {
-	SDL_Surface *pixbuf;
-	SDL_Rect dest, src;
+	SDL_FillRect(glyphs.atlas, NULL, 0);
+	glyphs.x = glyphs.y = glyphs.row_h = 0;
+	glyphs.nr = 0;
+	memset(glyphs.slot, 0, sizeof(glyphs.slot));
+}
+
+static unsigned glyph_hash(int idx, float s)
+{
+	Uint32 bits;
+	memcpy(&bits, &s, sizeof(bits));
+	return ((unsigned)idx * 31 + bits * 2654435761u) % GLYPH_SLOTS;
+}
+
+/* the glyph scaled to w x h in the atlas, NULL if it can't fit at all */
+static SDL_Rect *glyph_get(SDL_Surface *pixbuf, SDL_Rect *src, int idx, float s, int w, int h)
+{
+	unsigned i = glyph_hash(idx, s);
+
+	for (; glyphs.slot[i].used; i = (i + 1) % GLYPH_SLOTS) {
+		if (glyphs.slot[i].idx == idx && glyphs.slot[i].s == s) {
+			glyphs.hits++;
+			return &glyphs.slot[i].r;
+		}
+	}
+	glyphs.misses++;
+	if (w > GLYPH_ATLAS_W || h > GLYPH_ATLAS_H)
+		return NULL;
+	if (!glyphs.atlas) {
+		glyphs.atlas = SDL_CreateRGBSurface(
+			pixbuf->flags, GLYPH_ATLAS_W, GLYPH_ATLAS_H, 32,
+			pixbuf->format->Rmask,
+			pixbuf->format->Gmask,
+			pixbuf->format->Bmask,
+			pixbuf->format->Amask);
+		if (!glyphs.atlas)
+			return NULL;
+		glyph_reset();
+	}
+	if (glyphs.x + w > GLYPH_ATLAS_W) {
+		glyphs.x = 0;
+		glyphs.y += glyphs.row_h;
+		glyphs.row_h = 0;
+	}
+	if (glyphs.y + h > GLYPH_ATLAS_H || glyphs.nr >= GLYPH_SLOTS * 3 / 4) {
+		glyph_reset();
+		i = glyph_hash(idx, s);
+	}
+	glyphs.slot[i].used = true;
+	glyphs.slot[i].idx = idx;
+	glyphs.slot[i].s = s;
+	glyphs.slot[i].r.x = glyphs.x; glyphs.slot[i].r.w = w;
+	glyphs.slot[i].r.y = glyphs.y; glyphs.slot[i].r.h = h;
+	glyphs.x += w;
+	glyphs.row_h = _max(glyphs.row_h, h);
+	glyphs.nr++;
+	SDL_BlitScaled(pixbuf, src, glyphs.atlas, &glyphs.slot[i].r);
+	return &glyphs.slot[i].r;
+}
+
+void gfx_glyph_stats(unsigned *hits, unsigned *misses)
+{
+	*hits = glyphs.hits;
+	*misses = glyphs.misses;
+}
+
+/* a glyph's width at scale s, as drawn by glyph_blit() */
+static int glyph_advance(const char c, float s)
+{
+	if (c == ' ')
+		return font->w / 2;
+	int idx = fnt_calc_idx(font->n, c);
+	if (idx < 0)
+		return 0;
+	return s && s != 1 ? (int)(font->widths[idx] * s) : font->widths[idx];
+}
+
+/* onto the screen a glyph is blended, anywhere else it is copied as is */
+static int glyph_blit(const char c, SDL_Surface *dst, int x, int y, float s)
+{
+	SDL_Surface *pixbuf, *from;
+	SDL_Rect dest, src, *r;
 	
 	if (c == ' ')
 		return font->w / 2;
@@ -136,7 +439,7 @@ int gfx_draw_char(const char c, int x, int y, float s)
 	if (idx < 0)
 		return 0;
 	
-	pixbuf = (SDL_Surface *)(font->font);
+	from = pixbuf = (SDL_Surface *)(font->font);
 	dest.x = x;
 	dest.y = y;
 	
@@ -144,25 +447,36 @@ int gfx_draw_char(const char c, int x, int y, float s)
 	src.x = idx * font->w + (font->disp[idx]);
 	src.w = dest.w = font->widths[idx];
 	src.h = dest.h = font->h;
+	r = &src;
 	
 	if (s && s != 1) {
-		SDL_Rect scl;
-		scl.x = 0; scl.w = dest.w = (int)(dest.w * s);
-		scl.y = 0; scl.h = dest.h = (int)(dest.h * s);
-		SDL_Surface *scaled = SDL_CreateRGBSurface(
-			pixbuf->flags, scl.w, scl.h, 32,
-			pixbuf->format->Rmask,
-			pixbuf->format->Gmask,
-			pixbuf->format->Bmask,
-			pixbuf->format->Amask);
-		SDL_BlitScaled(pixbuf, &src, scaled, &scl);
-		SDL_BlitSurface(scaled, &scl, screen, &dest);
+		dest.w = (int)(dest.w * s);
+		dest.h = (int)(dest.h * s);
+		if (!dest.w || !dest.h)
+			return dest.w;
+		if (!(r = glyph_get(pixbuf, &src, idx, s, dest.w, dest.h)))
+			return dest.w;
+		from = glyphs.atlas;
 		//fprintf(stderr, "scaled: %f\n", s);
-	} else
-		SDL_BlitSurface(pixbuf, &src, screen, &dest);
+	}
+	if (dst == screen) {
+		SDL_BlitSurface(from, r, screen, &dest);
+		gfx_damage(&dest);
+	} else {
+		SDL_BlendMode mode;
+		SDL_GetSurfaceBlendMode(from, &mode);
+		SDL_SetSurfaceBlendMode(from, SDL_BLENDMODE_NONE);
+		SDL_BlitSurface(from, r, dst, &dest);
+		SDL_SetSurfaceBlendMode(from, mode);
+	}
 	return dest.w;
 }
 
+int gfx_draw_char(const char c, int x, int y, float s)
+{
+	return glyph_blit(c, screen, x, y, s);
+}
+
 int gfx_chars_width(const char *str)
 {
 	const int Wd = font->w / 2;
@@ -183,21 +497,12 @@ int gfx_chars_width(const char *str)
 	return result;
 }
 
-int gfx_draw_text(const char *str, int x, int y, float s)
-{
-	int x_orig = x;
-	for (int i = 0; i < strlen(str); i++) {
-		x += gfx_draw_char(str[i], x, y, s);
-	}
-	return x - x_orig;
-}
-
 int gfx_font_height(void)
 {
 	return font->h;
 }
 
-img_t gfx_draw_ttf_text(char *text)
+static SDL_Surface *ttf_render(const char *text)
 {
 	SDL_Color color = { 0x00, 0x00, 0x00 };
 	SDL_Surface* mask;
@@ -214,7 +519,7 @@ img_t gfx_draw_ttf_text(char *text)
 	SDL_Surface* pixbuf = SDL_CreateRGBSurfaceWithFormat(0,
 		(src.w = dest.w = fill->w) + 1,
 		(src.h = dest.h = fill->h) + 1,
-		8, SDL_PIXELFORMAT_RGBA8888
+		32, GFX_FORMAT
 	);
 	src.x = 0; dest.x = 1;
 	src.y = 0; dest.y = 1;
@@ -227,6 +532,130 @@ img_t gfx_draw_ttf_text(char *text)
 	return pixbuf;
 }
 
+/*
+*  Whole strings, rendered once and then drawn with one blit. The least
+*  recently used go when the cache is over TEXT_CACHE_BYTES.
+*/
+#define TEXT_CACHE_BYTES (256 * 1024)
+#define TEXT_TTF         (-1) /* scale of TTF strings */
+
+typedef struct text_t {
+	struct text_t *prev, *next;
+	SDL_Surface *img;
+	float s;
+	size_t bytes;
+	char str[];
+} text_t;
+
+static struct {
+	text_t *head, *tail; /* most and least recently used */
+	size_t bytes;
+	int nr;
+} texts;
+
+static SDL_Surface *text_render(const char *str, float s)
+{
+	SDL_Surface *img;
+	int w = 0, x = 0;
+
+	if (s == TEXT_TTF)
+		return ttf_render(str);
+	for (int i = 0; str[i]; i++)
+		w += glyph_advance(str[i], s);
+	if (!w || !(img = SDL_CreateRGBSurfaceWithFormat(0, w,
+			s != 1 ? (int)(font->h * s) : font->h, 32, GFX_FORMAT)))
+		return NULL;
+	for (int i = 0; str[i]; i++)
+		x += glyph_blit(str[i], img, x, 0, s);
+	return img;
+}
+
+static void text_unlink(text_t *t)
+{
+	*(t->prev ? &t->prev->next : &texts.head) = t->next;
+	*(t->next ? &t->next->prev : &texts.tail) = t->prev;
+}
+
+static void text_drop(text_t *t)
+{
+	text_unlink(t);
+	texts.bytes -= t->bytes;
+	texts.nr--;
+	SDL_FreeSurface(t->img);
+	free(t);
+}
+
+static SDL_Surface *text_get(const char *str, float s)
+{
+	text_t *t;
+	size_t len = strlen(str) + 1;
+
+	for (t = texts.head; t; t = t->next) {
+		if (t->s == s && !strcmp(t->str, str))
+			break;
+	}
+	if (t) {
+		text_unlink(t);
+	} else {
+		if (!(t = malloc(sizeof(*t) + len)))
+			return NULL;
+		if (!(t->img = text_render(str, s))) {
+			free(t);
+			return NULL;
+		}
+		memcpy(t->str, str, len);
+		t->s = s;
+		t->bytes = sizeof(*t) + len + t->img->pitch * t->img->h;
+		texts.bytes += t->bytes;
+		texts.nr++;
+	}
+	t->prev = NULL;
+	t->next = texts.head;
+	*(texts.head ? &texts.head->prev : &texts.tail) = t;
+	texts.head = t;
+	while (texts.bytes > TEXT_CACHE_BYTES && texts.tail != t)
+		text_drop(texts.tail);
+	return t->img;
+}
+
+static void text_free(void)
+{
+	while (texts.head)
+		text_drop(texts.head);
+}
+
+void gfx_text_stats(size_t *bytes, int *nr)
+{
+	*bytes = texts.bytes;
+	*nr = texts.nr;
+}
+
+static int text_draw(const char *str, int x, int y, float s, int *h)
+{
+	SDL_Rect dest = { x, y, 0, 0 };
+	SDL_Surface *img;
+	int w = 0;
+
+	if ((img = text_get(str, s))) {
+		SDL_BlitSurface(img, NULL, screen, &dest);
+		gfx_damage(&dest);
+		w = img->w;
+	}
+	if (h)
+		*h = img ? img->h : 0;
+	return w;
+}
+
+int gfx_draw_text(const char *str, int x, int y, float s)
+{
+	return text_draw(str, x, y, s ? s : 1, NULL);
+}
+
+int gfx_draw_ttf_text(const char *text, int x, int y, int *h)
+{
+	return text_draw(text, x, y, TEXT_TTF, h);
+}
+
 bool gfx_load_font(const char *file, const int cW)
 {
 	SDL_Surface *img = (SDL_Surface*)gfx_load_image(file, true);
@@ -286,6 +715,8 @@ void gfx_font_free(void)
 {
 	gfx_free_image(font->font);
 	free(font);
+	SDL_FreeSurface(glyphs.atlas);
+	glyphs.atlas = NULL;
 }
 
 void gfx_draw_bg(img_t p, int x, int y, int w, int h)
@@ -297,6 +728,29 @@ void gfx_draw_bg(img_t p, int x, int y, int w, int h)
 	src.w = dest.w = w;
 	src.h = dest.h = h;
 	SDL_BlitSurface(pixbuf, &src, screen, &dest);
+	gfx_damage(&dest);
+}
+
+void gfx_draw_part(img_t p, int sx, int sy, int w, int h, int x, int y)
+{
+	SDL_Rect dest, src;
+	src.x = sx; dest.x = x;
+	src.y = sy; dest.y = y;
+	src.w = dest.w = w;
+	src.h = dest.h = h;
+	SDL_BlitSurface((SDL_Surface *)p, &src, screen, &dest);
+	gfx_damage(&dest);
+}
+
+/* like the gfx_draw_*() calls, but onto dst and off the screen */
+void gfx_blit(img_t src, int sx, int sy, int w, int h, img_t dst, int x, int y)
+{
+	SDL_Rect dest, from;
+	from.x = sx; dest.x = x;
+	from.y = sy; dest.y = y;
+	from.w = dest.w = w;
+	from.h = dest.h = h;
+	SDL_BlitSurface((SDL_Surface *)src, &from, (SDL_Surface *)dst, &dest);
 }
 
 void gfx_draw(img_t p, int x, int y)
@@ -306,6 +760,14 @@ void gfx_draw(img_t p, int x, int y)
 	dest.x = x; dest.w = pixbuf->w;
 	dest.y = y; dest.h = pixbuf->h;
 	SDL_BlitSurface(pixbuf, NULL, screen, &dest);
+	gfx_damage(&dest);
+}
+
+void gfx_draw_alpha(img_t p, int x, int y, int alpha)
+{
+	SDL_SetSurfaceAlphaMod((SDL_Surface *)p, alpha);
+	gfx_draw(p, x, y);
+	SDL_SetSurfaceAlphaMod((SDL_Surface *)p, 0xFF);
 }
 
 void gfx_draw_wh(img_t p, int x, int y, int w, int h)
@@ -317,6 +779,7 @@ void gfx_draw_wh(img_t p, int x, int y, int w, int h)
 	src.w = dest.w = w;
 	src.h = dest.h = h;
 	SDL_BlitSurface(pixbuf, &src, screen, &dest);
+	gfx_damage(&dest);
 }
 
 void gfx_clear(int x, int y, int w, int h)
@@ -325,8 +788,11 @@ void gfx_clear(int x, int y, int w, int h)
 	dest.x = x; dest.y = y;
 	dest.w = w; dest.h = h;
 	SDL_FillRect(screen, &dest, SDL_MapRGB(screen->format, 0, 0, 0));
+	gfx_damage(&dest);
 }
 
+static void scale_init(void);
+
 bool gfx_init(void)
 {
 	if (SDL_CreateWindowAndRenderer(SCREEN_W, SCREEN_H,
@@ -372,13 +838,20 @@ bool gfx_init(void)
 
 		ttf = TTF_OpenFont(ttfpath, TTF_PX);
 	}
+	scale_init();
 	if (gfx_load_font("fnt.png", FONT_WIDTH))
 		return true;
 	return false;
 }
 
 void gfx_update(void) {
-	SDL_UpdateTexture( sdlTexture, NULL, screen->pixels, screen->pitch );
+	int i;
+
+	for (i = 0; i < damage.nr; i++) {
+		SDL_UpdateTexture( sdlTexture, &damage.rect[i], (Uint8 *)screen->pixels +
+			damage.rect[i].y * screen->pitch + damage.rect[i].x * screen->format->BytesPerPixel, screen->pitch );
+	}
+	damage.nr = 0;
 	SDL_RenderClear( sdlRenderer );
 	SDL_RenderCopy( sdlRenderer, sdlTexture, NULL, NULL );
 	SDL_RenderPresent( sdlRenderer );
@@ -386,9 +859,13 @@ void gfx_update(void) {
 
 void gfx_done(void)
 {
+	text_free();
 	TTF_CloseFont(ttf);
 	TTF_Quit();
 	gfx_font_free();
+	if (cache_map)
+		munmap(cache_map, cache_size);
+	cache_map = NULL;
 }
 
 /* code from sge */
@@ -601,6 +1078,156 @@ void _calcRect(SDL_Surface *src, SDL_Surface *dst, float theta, float xscale, fl
 		} \
 	} 
 
+/*
+*  32bpp fast path for unrotated transforms: the same 18.13 fixed point
+*  and weights as TRANSFORM_GENERIC_AA, worked on the packed pixels.
+*  With four 8-bit channels each byte is one channel whatever the order.
+*/
+#if defined(__x86_64__) || defined(__i386__)
+#define SCALE_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*scale_row_t)(Uint32 *d, const Uint32 *s0, const Uint32 *s1,
+	Sint32 sx, Sint32 ctx, Sint32 wy, int n);
+
+static scale_row_t scale_row;
+
+static void scale_row_c(Uint32 *d, const Uint32 *s0, const Uint32 *s1,
+	Sint32 sx, Sint32 ctx, Sint32 wy, int n)
+{
+	Sint32 const one = 2048, two = 2*2048;
+	for (int i = 0; i < n; i++, sx += ctx) {
+		Sint16 rx = (Sint16)(sx >> 13);
+		Sint32 wx = (sx & 0x00001FFF) >> 2;
+		Sint32 p1 = two-wx-wy, p2 = wx+one-wy, p3 = one-wx+wy, p4 = wx+wy;
+		Uint32 c = 0;
+		for (int sh = 0; sh < 32; sh += 8) {
+			Uint32 v = p1 * (s0[rx] >> sh & 0xFF) + p2 * (s0[rx+1] >> sh & 0xFF) +
+				p3 * (s1[rx] >> sh & 0xFF) + p4 * (s1[rx+1] >> sh & 0xFF);
+			c |= (v >> 13 & 0xFF) << sh;
+		}
+		d[i] = c;
+	}
+}
+
+#ifdef SCALE_X86
+/* weights as 16-bit pairs, so madd does p1*c1 + p2*c2 per channel */
+#define SCALE_PAIR(a, b) ((Uint32)(a) | (Uint32)(b) << 16)
+
+__attribute__((target("sse2")))
+static void scale_row_sse2(Uint32 *d, const Uint32 *s0, const Uint32 *s1,
+	Sint32 sx, Sint32 ctx, Sint32 wy, int n)
+{
+	Sint32 const one = 2048, two = 2*2048;
+	__m128i const z = _mm_setzero_si128();
+	for (int i = 0; i < n; i++, sx += ctx) {
+		Sint16 rx = (Sint16)(sx >> 13);
+		Sint32 wx = (sx & 0x00001FFF) >> 2;
+		__m128i w12 = _mm_set1_epi32(SCALE_PAIR(two-wx-wy, wx+one-wy));
+		__m128i w34 = _mm_set1_epi32(SCALE_PAIR(one-wx+wy, wx+wy));
+		__m128i c12 = _mm_unpacklo_epi8(_mm_unpacklo_epi8(
+			_mm_cvtsi32_si128(s0[rx]), _mm_cvtsi32_si128(s0[rx+1])), z);
+		__m128i c34 = _mm_unpacklo_epi8(_mm_unpacklo_epi8(
+			_mm_cvtsi32_si128(s1[rx]), _mm_cvtsi32_si128(s1[rx+1])), z);
+		__m128i v = _mm_srli_epi32(_mm_add_epi32(
+			_mm_madd_epi16(c12, w12), _mm_madd_epi16(c34, w34)), 13);
+		v = _mm_packs_epi32(v, v);
+		d[i] = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+	}
+}
+
+/* two pixels a step, one per 128-bit lane */
+__attribute__((target("avx2")))
+static void scale_row_avx2(Uint32 *d, const Uint32 *s0, const Uint32 *s1,
+	Sint32 sx, Sint32 ctx, Sint32 wy, int n)
+{
+	Sint32 const one = 2048, two = 2*2048;
+	int i;
+	for (i = 0; i + 1 < n; i += 2, sx += 2 * ctx) {
+		Sint32 sx2 = sx + ctx;
+		Sint16 ra = (Sint16)(sx >> 13), rb = (Sint16)(sx2 >> 13);
+		Sint32 wa = (sx & 0x00001FFF) >> 2, wb = (sx2 & 0x00001FFF) >> 2;
+		__m256i w12 = _mm256_setr_epi32(
+			SCALE_PAIR(two-wa-wy, wa+one-wy), SCALE_PAIR(two-wa-wy, wa+one-wy),
+			SCALE_PAIR(two-wa-wy, wa+one-wy), SCALE_PAIR(two-wa-wy, wa+one-wy),
+			SCALE_PAIR(two-wb-wy, wb+one-wy), SCALE_PAIR(two-wb-wy, wb+one-wy),
+			SCALE_PAIR(two-wb-wy, wb+one-wy), SCALE_PAIR(two-wb-wy, wb+one-wy));
+		__m256i w34 = _mm256_setr_epi32(
+			SCALE_PAIR(one-wa+wy, wa+wy), SCALE_PAIR(one-wa+wy, wa+wy),
+			SCALE_PAIR(one-wa+wy, wa+wy), SCALE_PAIR(one-wa+wy, wa+wy),
+			SCALE_PAIR(one-wb+wy, wb+wy), SCALE_PAIR(one-wb+wy, wb+wy),
+			SCALE_PAIR(one-wb+wy, wb+wy), SCALE_PAIR(one-wb+wy, wb+wy));
+		__m256i c12 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(
+			_mm_setr_epi32(s0[ra], s0[rb], 0, 0), _mm_setr_epi32(s0[ra+1], s0[rb+1], 0, 0)));
+		__m256i c34 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(
+			_mm_setr_epi32(s1[ra], s1[rb], 0, 0), _mm_setr_epi32(s1[ra+1], s1[rb+1], 0, 0)));
+		__m256i v = _mm256_srli_epi32(_mm256_add_epi32(
+			_mm256_madd_epi16(c12, w12), _mm256_madd_epi16(c34, w34)), 13);
+		v = _mm256_packs_epi32(v, v);
+		v = _mm256_packus_epi16(v, v);
+		d[i]   = _mm_cvtsi128_si32(_mm256_castsi256_si128(v));
+		d[i+1] = _mm_cvtsi128_si32(_mm256_extracti128_si256(v, 1));
+	}
+	if (i < n)
+		scale_row_sse2(d + i, s0, s1, sx, ctx, wy, n - i);
+}
+#endif
+
+static void scale_init(void)
+{
+	scale_row = scale_row_c;
+#ifdef SCALE_X86
+	if (SDL_HasAVX2())
+		scale_row = scale_row_avx2;
+	else if (SDL_HasSSE2())
+		scale_row = scale_row_sse2;
+#endif
+}
+
+static bool scale_byte_mask(Uint32 m)
+{
+	return m == 0xFF || m == 0xFF00 || m == 0xFF0000 || m == 0xFF000000;
+}
+
+static bool scale_fast(SDL_Surface *src, SDL_Surface *dst)
+{
+	SDL_PixelFormat *s = src->format, *d = dst->format;
+	return scale_row && s->BytesPerPixel == 4 && d->BytesPerPixel == 4 &&
+		scale_byte_mask(s->Rmask) && scale_byte_mask(s->Gmask) &&
+		scale_byte_mask(s->Bmask) && scale_byte_mask(s->Amask) &&
+		s->Rmask == d->Rmask && s->Gmask == d->Gmask &&
+		s->Bmask == d->Bmask && s->Amask == d->Amask;
+}
+
+#define TRANSFORM_SCALE_32 \
+	for (y=ymin; y<ymax; y++){ \
+		Sint32 n; \
+		dy = y - qy; \
+\
+		sx = (Sint32)(ctdx  + stx*dy + mx); \
+		sy = (Sint32)(cty*dy - stdx  + my); \
+		ry = (Sint16)(sy >> 13); \
+		if( (ry<symin) || (ry+1>symax) ) \
+			continue; \
+\
+		/* the source pixels in reach form one run */ \
+		for (x=xmin; x<xmax; x++, sx += ctx){ \
+			rx = (Sint16)(sx >> 13); \
+			if( (rx>=sxmin) && (rx+1<=sxmax) ) \
+				break; \
+		} \
+		for (n=0; x+n<xmax; n++){ \
+			rx = (Sint16)((sx + n*ctx) >> 13); \
+			if( (rx<sxmin) || (rx+1>sxmax) ) \
+				break; \
+		} \
+		scale_row((Uint32 *)((Uint8 *)dst->pixels + y*dst->pitch) + x, \
+			(Uint32 *)((Uint8 *)src->pixels + ry*src->pitch), \
+			(Uint32 *)((Uint8 *)src->pixels + (ry+1)*src->pitch), \
+			sx, ctx, (sy & 0x00001FFF) >> 2, n); \
+	}
+
 Uint8 _sge_lock = 1;
 
 SDL_Rect sge_transformAA(SDL_Surface *src, SDL_Surface *dst, float angle, float xscale, float yscale ,Uint16 px, Uint16 py, Uint16 qx, Uint16 qy, Uint8 flags)
@@ -667,7 +1294,11 @@ SDL_Rect sge_transformAA(SDL_Surface *src, SDL_Surface *dst, float angle, float
 		}
 	}
 	
-	TRANSFORM_GENERIC_AA
+	if (theta == 0 && scale_fast(src, dst)) {
+		TRANSFORM_SCALE_32
+	} else {
+		TRANSFORM_GENERIC_AA
+	}
 	
 	// Unlock surfaces
 	if ( SDL_MUSTLOCK(src) && _sge_lock )
@@ -7,25 +7,37 @@
 typedef void* img_t;
 extern bool gfx_init  (void);
 extern void gfx_update(void);
+extern void gfx_expose(void); /* the next gfx_update() sends the whole screen */
 extern void gfx_done  (void);
 extern void gfx_clear(int x, int y, int w, int h);
 extern void gfx_draw(img_t pixmap, int x, int y);
+extern void gfx_draw_alpha(img_t pixmap, int x, int y, int alpha);
 extern void gfx_draw_wh(img_t p, int x, int y, int w, int h);
+extern void gfx_draw_part(img_t p, int sx, int sy, int w, int h, int x, int y);
+extern void gfx_blit(img_t src, int sx, int sy, int w, int h, img_t dst, int x, int y);
 extern img_t gfx_grab_screen(int x, int y, int w, int h);
-extern img_t gfx_draw_ttf_text(char *text);
+extern int gfx_draw_ttf_text(const char *text, int x, int y, int *h); /* returns the width */
 extern img_t gfx_load_image(const char *file, bool alpha);
 extern void gfx_free_image(img_t pixmap);
 extern int gfx_img_w(img_t pixmap);
 extern int gfx_img_h(img_t pixmap);
+extern img_t gfx_new_image(int w, int h, int r, int g, int b, int a);
+extern img_t gfx_new_screen_image(int w, int h);
 extern img_t gfx_combine(img_t src, img_t dst);
 extern img_t gfx_set_alpha(img_t src, int alpha);
 extern img_t gfx_scale(img_t src, float xscale, float yscale);
+extern uint64_t gfx_cache_key (uint64_t key, const void *data, size_t size);
+extern uint64_t gfx_cache_file(uint64_t key, const char *file); /* mtime and size of gfx/file */
+extern bool gfx_cache_load(const char *path, uint64_t key, img_t **imgs, int nr);
+extern bool gfx_cache_save(const char *path, uint64_t key, img_t **imgs, int nr);
 extern void gfx_draw_bg(img_t p, int x, int y, int w, int h);
 
 extern int gfx_draw_char  ( const char  c,   int x, int y, float s);
 extern int gfx_draw_text  ( const char *str, int x, int y, float s);
 extern int gfx_chars_width( const char *str);
 extern int gfx_font_height( void );
+extern void gfx_glyph_stats(unsigned *hits, unsigned *misses); /* scaled glyph cache */
+extern void gfx_text_stats(size_t *bytes, int *nr); /* rendered string cache */
 
 extern char GAME_DIR[ PATH_MAX ];
 #endif
@@ -30,8 +30,11 @@ char GAME_DIR[ PATH_MAX ];
 static char SAVE_PATH   [ PATH_MAX ];
 static char SCORES_PATH [ PATH_MAX ];
 static char PREFS_PATH  [ PATH_MAX ];
+static char CACHE_PATH  [ PATH_MAX ];
 
-#define GFX_UPDATE  0x321
+#define MUSIC_DONE  SDL_USEREVENT
+#define TICK_MS     20 /* simulation step, effects advance one step per tick */
+#define CATCHUP_MAX 5  /* ticks run back to back after a stall, the rest is dropped */
 #define POOL_SPACE  8
 #define SCORES_X    60
 #define SCORES_Y    225
@@ -73,7 +76,7 @@ static struct __SET__ {
 };
 
 static struct __STAT__ {
-	bool running, game_over, update_needed, store_prefs;
+	bool running, game_over, update_needed, store_prefs, hidden;
 } status = {
 	.store_prefs   = false,
 	.update_needed = false,
@@ -98,33 +101,38 @@ static elemen_t Loop    = { .name = "loop" };
 static elemen_t Info    = { .name = "info" };
 static elemen_t Vol     = { .name = "vol" };
 
-SDL_mutex *game_mutex;
+#define PREVIEW_REACH 1
+#define PREVIEW_PATH  2
 
-void game_lock(void)
-{
-	SDL_mutexP(game_mutex);
-}
+static struct __PREV__ {
+	int hx, hy; /* hovered cell */
+	cell_t cell[BOARD_W][BOARD_H]; /* tint drawn by draw_cell() */
+	img_t reach, path;
+} Preview = {
+	.hx = -1,
+	.hy = -1
+};
 
-void game_unlock(void)
-{
-	SDL_mutexV(game_mutex);
-}
+static cl_engine *engine;
+static cl_snapshot view; /* of the engine, taken once per tick */
 
 int   moving_nr = 0;
 img_t pb_logo = NULL;
 img_t bg_saved = NULL;
-img_t balls[BALLS_NR][ALPHA_STEPS];
+img_t balls[BALLS_NR]; /* faded at blit time */
 img_t resized_balls[BALLS_NR][SIZE_STEPS];
 img_t jumping_balls[BALLS_NR][JUMP_STEPS];
 img_t cell, bg;
+img_t tiles; /* bg, tint and cell made into one, see make_tiles() */
 
 static bool _Is_onElement(elemen_t target, int x, int y)
 {
 	return !(x < target.x || y < target.y || x >= target.x + target.w || y >= target.y + target.h);
 }
 
-static bool load_Img_for(elemen_t *target)
+static bool load_Img_for(void *arg)
 {
+	elemen_t *target = arg;
 	char ion[ 24 ], ioff[ 24 ];
 	
 	bool loaded = !strcmp(target->name, "vol");
@@ -146,7 +154,7 @@ static void draw_Button_for(elemen_t *target, bool enabled)
 {
 	gfx_draw_bg(bg, target->x, target->y, target->w, target->h);
 	gfx_draw((enabled ? target->on : target->off), target->x, target->y);
-	gfx_update();
+	status.update_needed = true;
 }
 
 static void free_Img_for(elemen_t *target)
@@ -161,26 +169,24 @@ static void draw_Volume_bar(void)
 	gfx_draw_bg(bg, Vol.x, Vol.y, Vol.w, Vol.h);
 	gfx_draw(Vol.off, Vol.x, Vol.y);
 	gfx_draw_wh(Vol.on, Vol.x, Vol.y, bar, Vol.h);
-	gfx_update();
+	status.update_needed = true;
 }
 
 static void draw_Track_title(void)
 {
 	gfx_draw_bg(bg, Track.x, Track.y, Track.w, Track.h);
-	Track.on = gfx_draw_ttf_text(Track.name);
-	Track.w  = gfx_img_w(Track.on);
-	Track.h  = gfx_img_h(Track.on);
-	gfx_draw_wh(Track.on, Track.x, Track.y, Track.w, Track.h);
-	gfx_update();
+	Track.w = gfx_draw_ttf_text(Track.name, Track.x, Track.y, &Track.h);
+	status.update_needed = true;
 }
 
 /* <==== Game Timer ====> */
-SDL_TimerID gameTimerId;
+static struct {
+	bool on;
+	Uint32 next; /* SDL_GetTicks() of the next second */
+} Clock;
 
-Uint32 draw_Timer_digit(Uint32 interval, void *_)
+static void draw_Timer_digit(void)
 {
-	Settings.lastTime++;
-	
 	sprintf(Timer.name, "%02d:%02d", (int)(Settings.lastTime / 60), Settings.lastTime % 60);
 	gfx_draw_bg(bg, Timer.x, Timer.y, Timer.w, Timer.h);
 	
@@ -189,16 +195,37 @@ Uint32 draw_Timer_digit(Uint32 interval, void *_)
 	
 	gfx_draw_text(Timer.name, Timer.x, Timer.y, Timer.temp);
 	status.update_needed = true;
-	
-	return interval;
 }
 void start_GameTimer()
 {
-	gameTimerId = SDL_AddTimer(1e3, draw_Timer_digit, NULL);
+	Clock.on = true;
+	Clock.next = SDL_GetTicks() + 1000;
 }
 void stop_GameTimer()
 {
-	SDL_RemoveTimer( gameTimerId );
+	Clock.on = false;
+}
+/* counts the seconds gone by, so an idle loop need not wake for them */
+static void tick_GameTimer(void)
+{
+	Uint32 now = SDL_GetTicks();
+
+	if (!Clock.on || (Sint32)(now - Clock.next) < 0)
+		return;
+	while ((Sint32)(now - Clock.next) >= 0) {
+		Settings.lastTime++;
+		Clock.next += 1000;
+	}
+	draw_Timer_digit();
+}
+/* ms to the next second worth drawing, -1 if none */
+static int wait_GameTimer(void)
+{
+	Sint32 ms = SDL_GetTicks() - Clock.next;
+
+	if (!Clock.on || status.hidden)
+		return -1;
+	return ms >= 0 ? 0 : -ms;
 } /* <=== END ===> */
 
 static int get_word(const char *str, char *word)
@@ -222,17 +249,17 @@ static struct _gfx_word {
 	const char *name;
 	img_t	*img;
 } gfx_words[] = {
-	{ "ball_color1", &balls[0][ALPHA_STEPS - 1] },
-	{ "ball_color2", &balls[1][ALPHA_STEPS - 1] },
-	{ "ball_color3", &balls[2][ALPHA_STEPS - 1] },
-	{ "ball_color4", &balls[3][ALPHA_STEPS - 1] },
-	{ "ball_color5", &balls[4][ALPHA_STEPS - 1] },
-	{ "ball_color6", &balls[5][ALPHA_STEPS - 1] },
-	{ "ball_color7", &balls[6][ALPHA_STEPS - 1] },
-	{ "ball_joker" , &balls[7][ALPHA_STEPS - 1] }, 
-	{ "ball_bomb"  , &balls[8][ALPHA_STEPS - 1] },
-	{ "ball_brush" , &balls[9][ALPHA_STEPS - 1] }, 
-	{ "ball_boom" , &balls[10][ALPHA_STEPS - 1] },
+	{ "ball_color1", &balls[0] },
+	{ "ball_color2", &balls[1] },
+	{ "ball_color3", &balls[2] },
+	{ "ball_color4", &balls[3] },
+	{ "ball_color5", &balls[4] },
+	{ "ball_color6", &balls[5] },
+	{ "ball_color7", &balls[6] },
+	{ "ball_joker" , &balls[7] }, 
+	{ "ball_bomb"  , &balls[8] },
+	{ "ball_brush" , &balls[9] }, 
+	{ "ball_boom" , &balls[10] },
 	{ "pb_logo", &pb_logo },
 	{ NULL },
 };
@@ -327,7 +354,6 @@ static const char *last_text = NULL;
 static void show_info_window(void)
 {
 	last_text = cur_text;
-	game_lock();
 	if (!bg_saved && !(
 		 bg_saved = gfx_grab_screen(
 			BOARD_X - TILE_WIDTH - POOL_SPACE,
@@ -343,20 +369,16 @@ static void show_info_window(void)
 		cur_text = game_print(cur_text);
 		draw_Button_for(&Info, (Info.hook = true));
 	}
-	game_unlock();
 }
 
 static void hide_info_window(void)
 {
 	cur_text = last_text ?: info_text;
-	game_lock();
 	gfx_draw(bg_saved, BOARD_X - TILE_WIDTH - POOL_SPACE, BOARD_Y);
-	gfx_update();
 	bg_saved = 0;
 	gfx_free_image(bg_saved);
 	draw_Button_for(&Info, (Info.hook = false));
 	start_GameTimer();
-	game_unlock();
 }
 
 static int game_hiscores[HISCORES_NR] = { 50, 40, 30, 20, 10 };
@@ -372,16 +394,28 @@ enum {
 typedef struct {
 	cell_t cell, cell_from;
 	short effect, step;
-	bool reUse, reDraw;
-	int x, y, tx, ty, id;
+	bool reUse, reDraw; /* set reDraw with set_redraw() only */
+	short live; /* place in its live list + 1, 0 if not there */
+	int x, y, tx, ty;
+	int path_at, path_nr; /* the way of a moving ball, as CL_EV_MOVE gave it */
+	struct {
+		cell_t x, y;
+	} path[BOARD_W * BOARD_H];
 } ball_t;
 
 ball_t game_board[BOARD_W][BOARD_H];
 ball_t game_pool[POOL_SIZE];
 
+/* balls with reDraw set, so a tick visits only those */
+typedef struct {
+	int nr;
+	ball_t *ball[BOARD_W * BOARD_H];
+} live_t;
+
+static live_t live_board, live_pool;
+
 void draw_cell(int x, int y);
 void update_cell(int x, int y);
-void update_all(void);
 void draw_ball(int n, int x, int y);
 void draw_ball_offset(int n, int x, int y, int dx, int dy);
 void draw_ball_alpha(int n, int x, int y, int alpha);
@@ -399,13 +433,28 @@ static void game_loadprefs(const char *path);
 static void game_saveprefs(const char *path);
 static int set_volume(int x);
 
+static void set_redraw(ball_t *b, bool on)
+{
+	live_t *l = (b >= game_pool && b < game_pool + POOL_SIZE) ? &live_pool : &live_board;
+
+	b->reDraw = on;
+	if (on && !b->live) {
+		l->ball[l->nr++] = b;
+		b->live = l->nr;
+	} else if (!on && b->live) { /* the last one fills the hole */
+		l->ball[b->live - 1] = l->ball[--l->nr];
+		l->ball[b->live - 1]->live = b->live;
+		b->live = 0;
+	}
+}
+
 static void enable_effect(int x, int y, int effect)
 {
 	ball_t *b = (x == -1 ? &game_pool[y] : &game_board[x][y]);
 	b->x = x;
 	b->y = y;
 	b->reUse  = true;
-	b->reDraw = true;
+	set_redraw(b, true);
 	b->effect = effect;
 	b->step   = 0;
 }
@@ -413,36 +462,45 @@ static void enable_effect(int x, int y, int effect)
 static void disable_effect(int x, int y)
 {
 	ball_t *b = (x == -1 ? &game_pool[y] : &game_board[x][y]);
-	b->reDraw = true;
+	set_redraw(b, true);
 	b->effect = 0;
 }
 
 void game_move_ball(void)
 {
-	static int x, y;
-	int tx, ty;
-
-	bool move   = board_moved(&tx, &ty);
-	bool select = board_selected(&x, &y);
+	int x, y;
 
-	if (select && !game_board[x][y].effect && game_board[x][y].cell && game_board[x][y].reUse) {
+	if (board_selected(engine, &x, &y) && !game_board[x][y].effect && game_board[x][y].cell && game_board[x][y].reUse) {
 		enable_effect(x, y, jumping);
 		game_board[x][y].step = 0;
 	}
-	if (move && !game_board[tx][ty].cell) {
-		moving_nr++;
-		game_board[tx][ty].reUse = false;
-		game_board[tx][ty].cell = game_board[x][y].cell;
-		enable_effect(tx, ty, moving);
-		game_board[tx][ty].tx = tx;
-		game_board[tx][ty].ty = ty;
-		game_board[tx][ty].id = y * BOARD_W + x;
-		game_board[tx][ty].x = x;
-		game_board[tx][ty].y = y;
-		disable_effect(x, y);
-		game_board[x][y].reDraw = false;
-		game_board[x][y].reUse = false;
-		game_board[x][y].cell = 0;
+}
+
+/* tint the cells the selected ball can reach and the way to the hovered one */
+void game_preview(void)
+{
+	cell_t dist[BOARD_W][BOARD_H];
+	cell_t want[BOARD_W][BOARD_H];
+	int px[BOARD_W * BOARD_H], py[BOARD_W * BOARD_H];
+
+	memset(want, 0, sizeof(want));
+	if (board_reach(engine, dist)) {
+		for (int y = 0; y < BOARD_H; y++) {
+			for (int x = 0; x < BOARD_W; x++) {
+				if (dist[x][y] > 1)
+					want[x][y] = PREVIEW_REACH;
+			}
+		}
+		for (int n = board_preview(engine, Preview.hx, Preview.hy, px, py); n--; )
+			want[px[n]][py[n]] = PREVIEW_PATH;
+	}
+	for (int y = 0; y < BOARD_H; y++) {
+		for (int x = 0; x < BOARD_W; x++) {
+			if (want[x][y] != Preview.cell[x][y]) {
+				Preview.cell[x][y] = want[x][y];
+				set_redraw(&game_board[x][y], true);
+			}
+		}
 	}
 }
 
@@ -450,7 +508,7 @@ void game_process_pool(void)
 {
 	for (int x = 0; x < POOL_SIZE; x++) {
 
-		cell_t  c =  pool_cell(x);
+		cell_t  c =  view.pool[x];
 		ball_t *b = &game_pool[x];
 
 		if (c && !b->cell && !b->effect) {
@@ -472,7 +530,7 @@ void game_process_board(void)
 	for (int y = 0; y < BOARD_H; y ++) {
 		for (int x = 0; x < BOARD_W; x++) {
 
-			cell_t  c =  board_cell(x, y);
+			cell_t  c =  view.desk[x][y];
 			ball_t *b = &game_board[x][y];
 
 			if (c && !b->cell && !b->effect) {
@@ -505,32 +563,167 @@ void game_process_board(void)
 		snd_play(play_snd, 1);
 }
 
-void game_init(void)
+/* what the events played so far */
+static struct {
+	int score, score_mul;
+	bool over;
+	bool resync; /* some were lost, diff against the snapshot from now on */
+} played;
+
+/* nothing on the ball but a jump to cut short */
+static bool ball_ready(int x, int y)
 {
-	memset(game_board, 0, sizeof( game_board ));
-	memset(game_pool , 0, sizeof( game_pool  ));
+	ball_t *b = (x == -1 ? &game_pool[y] : &game_board[x][y]);
+	return !b->effect || b->effect == jumping;
+}
 
-	for (int y = 0; y < BOARD_H; y ++) {
-		for (int x = 0; x < BOARD_W; x++) {
-			game_board[x][y].reDraw = false;
+/* false if the balls it touches are still busy, it is tried again next tick */
+static bool game_event(const cl_event *ev, unsigned short *play_snd)
+{
+	ball_t *b;
+	int i, x, y;
+
+	switch (ev->type) {
+	case CL_EV_SPAWN:
+		if (!ball_ready(ev->x, ev->y) || !ball_ready(-1, ev->slot))
+			return false;
+		if (game_pool[ev->slot].cell)
+			enable_effect(-1, ev->slot, fadeout);
+		enable_effect(ev->x, ev->y, fadein);
+		game_board[ev->x][ev->y].cell = ev->ball;
+		break;
+	case CL_EV_POOL:
+		for (i = 0; i < ev->nr; i++) {
+			if (!ball_ready(-1, ev->cells[i].x))
+				return false;
+		}
+		for (i = 0; i < ev->nr; i++) {
+			enable_effect(-1, ev->cells[i].x, fadein);
+			game_pool[ev->cells[i].x].cell = ev->cells[i].ball;
+		}
+		break;
+	case CL_EV_MOVE:
+		x = ev->cells[ev->nr - 1].x;
+		y = ev->cells[ev->nr - 1].y;
+		if (!ball_ready(ev->x, ev->y) || !ball_ready(x, y))
+			return false;
+		moving_nr++;
+		b = &game_board[x][y];
+		b->reUse = false;
+		b->cell  = ev->ball;
+		enable_effect(x, y, moving);
+		b->tx = x;
+		b->ty = y;
+		b->x  = ev->x;
+		b->y  = ev->y;
+		b->path_at = 0;
+		b->path_nr = ev->nr;
+		for (i = 0; i < ev->nr; i++) {
+			b->path[i].x = ev->cells[i].x;
+			b->path[i].y = ev->cells[i].y;
+		}
+		disable_effect(ev->x, ev->y);
+		set_redraw(&game_board[ev->x][ev->y], false);
+		game_board[ev->x][ev->y].reUse  = false;
+		game_board[ev->x][ev->y].cell   = 0;
+		break;
+	case CL_EV_LINE:
+	case CL_EV_BOOM:
+	case CL_EV_PAINT:
+		for (i = 0; i < ev->nr; i++) {
+			if (!ball_ready(ev->cells[i].x, ev->cells[i].y))
+				return false;
+		}
+		for (i = 0; i < ev->nr; i++) {
+			b = &game_board[ev->cells[i].x][ev->cells[i].y];
+			if (!ev->cells[i].ball) {
+				if (b->cell)
+					enable_effect(ev->cells[i].x, ev->cells[i].y, fadeout);
+			} else if (b->cell) {
+				enable_effect(ev->cells[i].x, ev->cells[i].y, changing);
+				b->cell_from = b->cell;
+				b->cell = ev->cells[i].ball;
+			} else {
+				enable_effect(ev->cells[i].x, ev->cells[i].y, fadein);
+				b->cell = ev->cells[i].ball;
+			}
+		}
+		if (ev->type == CL_EV_BOOM)
+			*play_snd = SND_BOOM;
+		else if (ev->type == CL_EV_PAINT && *play_snd != SND_BOOM)
+			*play_snd = SND_PAINT;
+		else if (ev->nr && !*play_snd)
+			*play_snd = SND_FADEOUT;
+		break;
+	case CL_EV_SCORE:
+		played.score     = ev->score;
+		played.score_mul = ev->score_mul;
+		break;
+	case CL_EV_OVER:
+		played.over = true;
+		break;
+	}
+	return true;
+}
+
+static void game_drop_events(void)
+{
+	while (board_event(engine))
+		board_event_done(engine);
+	board_events_lost(engine);
+}
+
+/* Plays the engine's events in order, each one once the balls it touches
+ * are done with the last, so nothing has to be found by diffing the desk. */
+void game_process_events(void)
+{
+	const cl_event *ev;
+	unsigned short play_snd = 0;
+
+	if (board_events_lost(engine))
+		played.resync = true;
+	if (played.resync) {
+		game_drop_events();
+		game_process_board();
+		game_process_pool();
+		for (int y = 0; !moving_nr && y < BOARD_H; y++) {
+			for (int x = 0; x < BOARD_W; x++)
+				board_clear_path(engine, x, y); /* no one walks a lost move */
 		}
+		played.score     = view.score;
+		played.score_mul = view.score_mul;
+		played.over      = !view.running;
+		return;
 	}
+	while ((ev = board_event(engine)) && game_event(ev, &play_snd))
+		board_event_done(engine);
+	if (play_snd)
+		snd_play(play_snd, 1);
+}
+
+void game_init(void)
+{
+	memset(game_board, 0, sizeof( game_board ));
+	memset(game_pool , 0, sizeof( game_pool  ));
+	memset(Preview.cell, 0, sizeof( Preview.cell ));
+	live_board.nr = live_pool.nr = 0;
 }
 
 unsigned short game_display_board(void)
 {
 	unsigned short out = 0;
 
-	int tmpx, tmpy, x1, y1, dx, dy, dist;
+	int x, y, tmpx, tmpy, x1, y1, dx, dy, dist;
 	ball_t *b;
 
-	for (int y = 0; y < BOARD_H; y++) {
-		for (int x = 0; x < BOARD_W; x++) {
-
-			b = &game_board[x][y];
+	for (int pass = 0; pass < 2; pass++) { /* moving balls last, so nothing covers them */
+		for (int i = live_board.nr; i--; ) {
 
-			if (!b->reDraw)	
+			b = live_board.ball[i];
+			if ((b->effect == moving) != pass)
 				continue;
+			x = (b - &game_board[0][0]) / BOARD_H;
+			y = (b - &game_board[0][0]) % BOARD_H;
 
 			out++;
 
@@ -543,11 +736,11 @@ unsigned short game_display_board(void)
 				} else
 					b->cell = 0;
 				update_cell(x, y);
-				b->reDraw = false;
+				set_redraw(b, false);
 				break;
 			case fadein:
 				out--;
-				if (!board_path(b->x, b->y)) {
+				if (!board_path(engine, b->x, b->y)) {
 					draw_cell(b->x, b->y);
 					draw_ball_size(b->cell - 1, b->x, b->y, b->step); 
 					b->step ++;
@@ -571,18 +764,24 @@ unsigned short game_display_board(void)
 					draw_ball_offset(b->cell - 1, b->x, b->y, 0, dist - 2*JUMP_STEPS - 10);
 				b->step++;
 				update_cell(b->x, b->y);
-				if (dist == 2 * JUMP_STEPS && (!board_selected(&tmpx, &tmpy) || tmpx != b->x || tmpy != b->y)) {
+				if (dist == 2 * JUMP_STEPS && (!board_selected(engine, &tmpx, &tmpy) || tmpx != b->x || tmpy != b->y)) {
 					disable_effect(x, y);
 				} else if (b->step >= 3*JUMP_STEPS * 19 + 2*JUMP_STEPS) {
 					disable_effect(x, y);
-					board_select(-1, -1);
+					board_select(engine, -1, -1);
 				}
 				break;
 			case moving:
 				x1 = b->x;
 				y1 = b->y;
 				draw_cell(b->x, b->y);
-				board_follow_path(b->x, b->y, &tmpx, &tmpy, b->id);
+				if (b->path_at + 1 < b->path_nr) {
+					tmpx = b->path[b->path_at + 1].x;
+					tmpy = b->path[b->path_at + 1].y;
+				} else {
+					tmpx = b->x;
+					tmpy = b->y;
+				}
 				draw_cell(tmpx, tmpy);
 				dist = abs(b->tx - b->x) + abs(b->ty - b->y);
 				if (dist <= 2) {
@@ -592,9 +791,10 @@ unsigned short game_display_board(void)
 				dx = (tmpx - b->x) * b->step;
 				dy = (tmpy - b->y) * b->step;
 				if (abs(dx) >= TILE_WIDTH || abs(dy) >= TILE_HEIGHT) {
-					board_clear_path(b->x, b->y);
+					board_clear_path(engine, b->x, b->y);
 					b->x = tmpx;
 					b->y = tmpy;
+					b->path_at++;
 					dx = dy = 0;
 					b->step = 0;
 				}
@@ -602,8 +802,8 @@ unsigned short game_display_board(void)
 				update_cells(x1, y1, tmpx, tmpy);
 				if (b->x == b->tx && b->y == b->ty) {
 					moving_nr--;
-					board_clear_path(b->x, b->y);
-					b->reDraw = true;
+					board_clear_path(engine, b->x, b->y);
+					set_redraw(b, true);
 					b->effect = 0;
 					b->reUse  = true;
 				}
@@ -639,13 +839,12 @@ unsigned short game_display_board(void)
 void game_display_pool(void)
 {
 	ball_t *b;
+	int x;
 
-	for (int x = 0; x < POOL_SIZE; x++) {
-
-		b = &game_pool[x];
+	for (int i = live_pool.nr; i--; ) {
 
-		if (!b->reDraw)
-			continue;
+		b = live_pool.ball[i];
+		x = b - game_pool;
 
 		switch (b->effect) {
 		case 0:
@@ -655,7 +854,7 @@ void game_display_pool(void)
 			else
 				b->cell = 0;
 			update_cell(-1, x);
-			b->reDraw = false;
+			set_redraw(b, false);
 			break;
 		case fadein:
 			draw_cell(-1, b->y);
@@ -681,62 +880,161 @@ void game_display_pool(void)
 	}
 }
 
-bool load_balls(void)
+/* <==== Startup ====> */
+#define TASK_THREADS 8
+
+typedef struct {
+	bool (*run)(void *arg);
+	void *arg;
+	bool err;
+} task_t;
+
+static struct {
+	task_t *task;
+	int nr;
+	SDL_atomic_t next;
+} Startup;
+
+static int startup_worker(void *unused)
 {
-	img_t ball = gfx_load_image("ball.png", true);
-	if (!ball)
-		return true;
-	for (int i = 1; i <= BALLS_NR; i++) {
-		img_t color, new, alph, sized, jumped;
-		if (i == ball_joker) {
-			color = NULL;
-			new = gfx_load_image("joker.png", true);
-		} else if (i == ball_bomb) {
-			new = gfx_load_image("atomic.png", true);
-			color = NULL;
-		} else if (i == ball_brush) {
-			new = gfx_load_image("paint.png", true);
-			color = NULL;
-		} else if (i == ball_boom) {
-			new = gfx_load_image("boom.png", true);
-			color = NULL;
-		} else {
-			char fname[12];
-			snprintf(fname, sizeof(fname), "color%d.png", i);
-			color = gfx_load_image(fname, true);
-			if (!color)
-				return true;
-			new = gfx_combine(ball, color);
-		}
-		if (!new)
+	int i;
+	while ((i = SDL_AtomicAdd(&Startup.next, 1)) < Startup.nr)
+		Startup.task[i].err = Startup.task[i].run(Startup.task[i].arg);
+	return 0;
+}
+
+/* runs the tasks on up to one thread per core and waits for all of them */
+static void run_tasks(task_t *task, int nr)
+{
+	SDL_Thread *pool[TASK_THREADS];
+	int n = _min(_min(SDL_GetCPUCount(), TASK_THREADS), nr) - 1, i;
+
+	Startup.task = task;
+	Startup.nr = nr;
+	SDL_AtomicSet(&Startup.next, 0);
+	for (i = 0; i < n; i++) {
+		if (!(pool[i] = SDL_CreateThread(startup_worker, "startup", NULL)))
+			break;
+	}
+	startup_worker(NULL);
+	while (i-- > 0)
+		SDL_WaitThread(pool[i], NULL);
+}
+
+static img_t ball_base; /* ball.png, while the balls are made */
+static SDL_SpinLock ball_lock; /* a blit caches its mapping in the source */
+
+/* one ball type and its frames; runs on a startup thread */
+static bool make_ball(void *arg)
+{
+	int i = (intptr_t)arg;
+	img_t color, new, sized, jumped;
+	if (i == ball_joker) {
+		color = NULL;
+		new = gfx_load_image("joker.png", true);
+	} else if (i == ball_bomb) {
+		new = gfx_load_image("atomic.png", true);
+		color = NULL;
+	} else if (i == ball_brush) {
+		new = gfx_load_image("paint.png", true);
+		color = NULL;
+	} else if (i == ball_boom) {
+		new = gfx_load_image("boom.png", true);
+		color = NULL;
+	} else {
+		char fname[12];
+		snprintf(fname, sizeof(fname), "color%d.png", i);
+		color = gfx_load_image(fname, true);
+		if (!color)
 			return true;
-		for (int k = 1; k <= ALPHA_STEPS; k++) {
-			alph = gfx_set_alpha(new, (255 * 100 ) / (ALPHA_STEPS * 100/k));
-			balls[i - 1][k - 1] = alph;
-		}
-		for (int k = 1; k <= SIZE_STEPS; k++) {
-			float cff = (float)1.0 / ((float)SIZE_STEPS / (float)k);
-			sized = gfx_scale(new, cff, cff);
-			resized_balls[i - 1][k - 1] = sized;
-		}
-		for (int k = 1; k <= JUMP_STEPS; k++) {
-			float cff = 1.0 - (((float)(1.0 - JUMP_MAX) / (float)JUMP_STEPS) * k);
-			jumped = gfx_scale(new, 1.0 + (1.0 - cff), cff);
-			jumping_balls[i - 1][k - 1] = jumped;
-		}
-		gfx_free_image(new);	
-		gfx_free_image(color);
+		SDL_AtomicLock(&ball_lock);
+		new = gfx_combine(ball_base, color);
+		SDL_AtomicUnlock(&ball_lock);
+	}
+	if (!new)
+		return true;
+	if (!(balls[i - 1] = gfx_set_alpha(new, 0xFF)))
+		return true;
+	for (int k = 1; k <= SIZE_STEPS; k++) {
+		float cff = (float)1.0 / ((float)SIZE_STEPS / (float)k);
+		sized = gfx_scale(new, cff, cff);
+		resized_balls[i - 1][k - 1] = sized;
+	}
+	for (int k = 1; k <= JUMP_STEPS; k++) {
+		float cff = 1.0 - (((float)(1.0 - JUMP_MAX) / (float)JUMP_STEPS) * k);
+		jumped = gfx_scale(new, 1.0 + (1.0 - cff), cff);
+		jumping_balls[i - 1][k - 1] = jumped;
 	}
-	gfx_free_image(ball);
+	gfx_free_image(new);	
+	gfx_free_image(color);
 	return false;
 }
 
+/* every generated ball image, in cache order */
+#define BALL_IMAGES (BALLS_NR * (1 + SIZE_STEPS + JUMP_STEPS))
+
+static void ball_images(img_t **imgs)
+{
+	for (int i = 0; i < BALLS_NR; i++) {
+		*imgs++ = &balls[i];
+		for (int k = 0; k < SIZE_STEPS; k++)
+			*imgs++ = &resized_balls[i][k];
+		for (int k = 0; k < JUMP_STEPS; k++)
+			*imgs++ = &jumping_balls[i][k];
+	}
+}
+
+static uint64_t balls_key(void)
+{
+	static const char *files[] = { "ball.png", "joker.png", "atomic.png", "paint.png", "boom.png" };
+	const double steps[] = { BALLS_NR, ALPHA_STEPS, SIZE_STEPS, JUMP_STEPS, JUMP_MAX };
+	uint64_t key = gfx_cache_key(0, steps, sizeof(steps));
+	char fname[12];
+
+	for (int i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+		key = gfx_cache_file(key, files[i]);
+	for (int i = 1; i <= COLORS_NR; i++) {
+		snprintf(fname, sizeof(fname), "color%d.png", i);
+		key = gfx_cache_file(key, fname);
+	}
+	return key;
+}
+
+/* from the sprite cache if it is current, else queues a task per ball */
+static bool load_balls(task_t *task, int *nr)
+{
+	img_t *imgs[BALL_IMAGES];
+
+	ball_images(imgs);
+	if (!gfx_cache_load(CACHE_PATH, balls_key(), imgs, BALL_IMAGES))
+		return false;
+	if (!(ball_base = gfx_load_image("ball.png", true)))
+		return true;
+	for (int i = 1; i <= BALLS_NR; i++)
+		task[(*nr)++] = (task_t){ make_ball, (void *)(intptr_t)i };
+	return false;
+}
+
+/* after the ball tasks, caches what they made */
+static void store_balls(bool store)
+{
+	img_t *imgs[BALL_IMAGES];
+
+	if (!ball_base)
+		return;
+	gfx_free_image(ball_base);
+	ball_base = NULL;
+	if (!store)
+		return;
+	ball_images(imgs);
+	if (gfx_cache_save(CACHE_PATH, balls_key(), imgs, BALL_IMAGES))
+		fprintf(stderr, "Couldn't write sprite cache '%s'\n", CACHE_PATH);
+}
+
 void free_balls(void)
 {
 	for (int i = 0; i < BALLS_NR; i++) {
-		for (int k = 0; k < ALPHA_STEPS; k++) {
-			gfx_free_image(balls[i][k]);
-		}
+		gfx_free_image(balls[i]);
 		for (int k = 0; k < SIZE_STEPS; k++) {
 			gfx_free_image(resized_balls[i][k]);
 		}
@@ -762,7 +1060,7 @@ static void music_switch(void)
 	if (Settings.music == -1) {
 		Settings.music = Music.temp;
 		snd_music_start(Settings.music, Track.name);
-		if (!Track.on)
+		if (!Track.w)
 			draw_Track_title();
 	} else {
 		Music.temp = Settings.music;
@@ -780,7 +1078,6 @@ void track_switch(void)
 		if (Settings.music >= TRACKS_COUNT)
 			Settings.music = 0;
 		snd_music_start(Settings.music, Track.name);
-		gfx_free_image(Track.on);
 		draw_Track_title();
 	}
 }
@@ -788,49 +1085,61 @@ void track_switch(void)
 static int set_volume(int x)
 {
 	int disp = x < Music.w ? 0 : x > (Vol.w + Music.w) ? Vol.w : x - Music.w;
-	game_lock();
 	Settings.volume = (256 * disp) / Vol.w;
 	if (!Music.hook)
 		snd_volume(Settings.volume);
 	draw_Volume_bar();
 	status.store_prefs = true;
-	game_unlock();
 	return disp + Music.w;
 }
 
+/* pool column first, then the board; a row of tiles per tint */
+static void tile_at(int x, int y, int tint, int *tx, int *ty)
+{
+	*tx = (x + 1) * TILE_WIDTH;
+	*ty = (tint * BOARD_H + y) * TILE_HEIGHT;
+}
+
+/* every board and pool tile with the background under it, once */
+static bool make_tiles(void)
+{
+	img_t tint[] = { NULL, Preview.reach, Preview.path };
+	int nx, ny, tx, ty;
+
+	if (!(tiles = gfx_new_screen_image((BOARD_W + 1) * TILE_WIDTH, 3 * BOARD_H * TILE_HEIGHT)))
+		return true;
+	for (int t = 0; t < 3; t++) {
+		for (int x = t ? 0 : -1; x < BOARD_W; x++) {
+			for (int y = 0; y < (x < 0 ? POOL_SIZE : BOARD_H); y++) {
+				cell_to_screen(x, y, &nx, &ny);
+				tile_at(x, y, t, &tx, &ty);
+				gfx_blit(bg, nx, ny, TILE_WIDTH, TILE_HEIGHT, tiles, tx, ty);
+				if (tint[t])
+					gfx_blit(tint[t], 0, 0, TILE_WIDTH, TILE_HEIGHT, tiles, tx, ty);
+				gfx_blit(cell, 0, 0, TILE_WIDTH, TILE_HEIGHT, tiles, tx, ty);
+			}
+		}
+	}
+	return false;
+}
+
 void draw_cell(int x, int y)
 {
-	int nx, ny;
+	int nx, ny, tx, ty;
 	cell_to_screen(x, y, &nx, &ny);
-	gfx_draw_bg(bg, nx, ny, TILE_WIDTH, TILE_HEIGHT);
-	gfx_draw(cell, nx, ny);
+	tile_at(x, y, x >= 0 ? Preview.cell[x][y] : 0, &tx, &ty);
+	gfx_draw_part(tiles, tx, ty, TILE_WIDTH, TILE_HEIGHT, nx, ny);
 }
 
+/* graphics.c keeps track of what was drawn, just ask for a frame */
 void update_cell(int x, int y)
 {
 	status.update_needed = true;
-	int nx, ny;
-	cell_to_screen(x, y, &nx, &ny);
 }
 
 void update_cells(int x1, int y1, int x2, int y2)
 {
 	status.update_needed = true;
-	int nx1, ny1;
-	int nx2, ny2;
-	int tmp;
-	if (x1 > x2) {
-		tmp = x2;
-		x2 = x1;
-		x1 = tmp;
-	}
-	if (y1 > y2) {
-		tmp = y2;
-		y2 = y1;
-		y1 = tmp;
-	}
-	cell_to_screen(x1, y1, &nx1, &ny1);
-	cell_to_screen(x2 + 1, y2 + 1, &nx2, &ny2);
 }
 
 void mark_cells_dirty(int x1, int y1, int x2, int y2)
@@ -850,26 +1159,16 @@ void mark_cells_dirty(int x1, int y1, int x2, int y2)
 	x = x1;
 	for (; y1 <= y2; y1++) {
 		for (x1 = x; x1 <= x2; x1++)
-			game_board[x1][y1].reDraw = true;
+			set_redraw(&game_board[x1][y1], true);
 	}
 }
 
-void update_all(void)
-{
-	if (status.update_needed) {
-		SDL_Event upd_event;
-		upd_event.type = GFX_UPDATE;
-		SDL_PushEvent(&upd_event);
-	}
-	status.update_needed = false;
-}
-
 
 void draw_ball_alpha_offset(int n, int alpha, int x, int y, int dx, int dy)
 {
 	int nx, ny;
 	cell_to_screen(x, y, &nx, &ny);
-	gfx_draw(balls[n][alpha], nx + 5 + dx, ny + 5 + dy);
+	gfx_draw_alpha(balls[n], nx + 5 + dx, ny + 5 + dy, (255 * 100) / (ALPHA_STEPS * 100 / (alpha + 1)));
 }
 
 void draw_ball_alpha(int n, int x, int y, int alpha)
@@ -910,7 +1209,7 @@ static void fetch_game_board(void)
 {
 	for (int y = 0; y < BOARD_H; y++) {
 		for (int x = 0; x < BOARD_W; x++) {
-			game_board[x][y].cell = board_cell(x, y);
+			game_board[x][y].cell = board_cell(engine, x, y);
 			if (game_board[x][y].cell) {
 				game_board[x][y].x = x;
 				game_board[x][y].y = y;
@@ -932,162 +1231,206 @@ static void draw_board(void)
 	}
 }
 
-Uint32 gameHandler(Uint32 interval, void *_)
-{
-	if (status.running) {
-		if (!Info.hook) {
-			game_lock();
-			game_move_ball();
-			game_process_board();
-			game_process_pool();
-			show_score();
-			game_display_pool();
-			if (!game_display_board()) { /* nothing todo */
-				board_logic();
-				if (!board_running() && !status.update_needed && !status.game_over) {
-					stop_GameTimer();
-					game_message("Game Over!", (status.game_over = true));
-					if (check_hiscores(board_score())) {
-						snd_play(SND_HISCORE, 1);
-						show_hiscores();
-					} else {
-						snd_play(SND_GAMEOVER, 1);
-					}
-					status.update_needed = true;
-					remove(SAVE_PATH);
-				}
+int cur_score = -1;
+int cur_mul = 0;
+static unsigned short score_timer = 0; /* bonus blinking */
+
+/* one fixed step of the game: clock, engine and effects */
+static void game_tick(void)
+{
+	tick_GameTimer();
+	if (Info.hook)
+		return;
+	board_snapshot(engine, &view);
+	game_move_ball();
+	game_preview();
+	game_process_events();
+	show_score();
+	game_display_pool();
+	if (!game_display_board()) { /* nothing todo */
+		board_logic(engine);
+		if (played.over && !status.update_needed && !status.game_over) {
+			stop_GameTimer();
+			game_message("Game Over!", (status.game_over = true));
+			if (check_hiscores(board_score(engine))) {
+				snd_play(SND_HISCORE, 1);
+				show_hiscores();
+			} else {
+				snd_play(SND_GAMEOVER, 1);
 			}
-			update_all();
-			game_unlock();
+			status.update_needed = true;
+			remove(SAVE_PATH);
 		}
-	} else
-		return 0;
-	return interval;
+	}
 }
 
-static void game_loop() {
-	// Main loop
-	SDL_Event event;
+/* anything left to animate or step; if not, the loop sleeps until input */
+static bool game_busy(void)
+{
+	if (Info.hook) /* the game stands still under it */
+		return false;
+	return live_board.nr || live_pool.nr || moving_nr || board_event(engine) || !board_waiting(engine) ||
+		cur_score < played.score || score_timer || (played.over && !status.game_over);
+}
 
-	bool Board_touch = false;
+/* music ends on the audio thread, the track switches on ours */
+void music_finished(void)
+{
+	SDL_Event done = { .type = MUSIC_DONE };
+	SDL_PushEvent(&done);
+}
 
-	SDL_AddTimer(20, &gameHandler, NULL);
-	
-	while (status.running) {
-		if (SDL_WaitEvent(&event)) {
-			//fprintf(stderr,"event %d\n", event.type);
-			int x = event.button.x;
-			int y = event.button.y;
-			if (event.key.state == SDL_PRESSED) {
-				if (event.key.keysym.sym == SDLK_ESCAPE) {
-					game_lock();
-					status.running = false;
-					game_unlock();
-				}
+static void game_input(SDL_Event *event)
+{
+	static bool Board_touch = false;
+
+	int x = event->button.x;
+	int y = event->button.y;
+	if (event->key.state == SDL_PRESSED) {
+		if (event->key.keysym.sym == SDLK_ESCAPE)
+			status.running = false;
+	}
+	switch (event->type) {
+	case MUSIC_DONE:
+		track_switch();
+		break;
+	case SDL_QUIT: // Quit the game
+		status.running = false;
+		break;
+	case SDL_MOUSEMOTION:
+		Board_touch = !(x < BOARD_X || y < BOARD_Y || x >= BOARD_X + BOARD_WIDTH || y >= BOARD_Y + BOARD_HEIGHT);
+		  Vol.touch = _Is_onElement(Vol, x, y);
+		Preview.hx = Board_touch ? (x - BOARD_X) / TILE_WIDTH  : -1;
+		Preview.hy = Board_touch ? (y - BOARD_Y) / TILE_HEIGHT : -1;
+		if (Vol.hook)
+			Vol.temp = set_volume(x);
+		break;
+	case SDL_MOUSEBUTTONUP:
+		Track.hook = Vol.hook = false;
+		break;
+	case SDL_MOUSEBUTTONDOWN: // Button pressed
+		if (Board_touch) {
+			if (Info.hook) {
+				show_info_window();
+			} else if (board_running(engine)) {
+				board_select(engine,
+					(x - BOARD_X) / TILE_WIDTH,
+					(y - BOARD_Y) / TILE_HEIGHT);
+			} else {
+				game_restart(true);
 			}
-			switch (event.type) {
-			case GFX_UPDATE:
-				gfx_update();
-				break;
-			case SDL_QUIT: // Quit the game
-				game_lock();
-				status.running = false;
-				game_unlock();
-				break;
-			case SDL_MOUSEMOTION:
-				Board_touch = !(x < BOARD_X || y < BOARD_Y || x >= BOARD_X + BOARD_WIDTH || y >= BOARD_Y + BOARD_HEIGHT);
-				  Vol.touch = _Is_onElement(Vol, x, y);
-				if (Vol.hook)
-					Vol.temp = set_volume(x);
-				break;
-			case SDL_MOUSEBUTTONUP:
-				Track.hook = Vol.hook = false;
-				break;
-			case SDL_MOUSEBUTTONDOWN: // Button pressed
-				if (Board_touch) {
-					if (Info.hook) {
-						show_info_window();
-					} else if (board_running()) {
-						board_select(
-							(x - BOARD_X) / TILE_WIDTH,
-							(y - BOARD_Y) / TILE_HEIGHT);
-					} else {
-						game_restart(true);
-					}
-				}
-				else if ((Vol.hook = Vol.touch)) {
-					Vol.temp = set_volume(x);
-				}
-				else if (_Is_onElement(Restart, x, y)) {
-					if (board_running()) {
-						snd_play(
-							check_hiscores(board_score()) ? SND_HISCORE : SND_GAMEOVER, 1);
-					}
-					game_restart(true);
-				}
-				else if (_Is_onElement(Music, x, y)) {
-					music_switch();
-				}
-				else if ((Track.hook = _Is_onElement(Track, x, y))) {
-					track_switch();
-				}
-				else if (_Is_onElement(Loop, x, y)) {
-					draw_Button_for(&Loop, (Settings.loop ^= 1));
-				}
-				else if (_Is_onElement(Info, x, y)) {
-					Info.hook ? hide_info_window() : show_info_window();
-				}
-				break;
-			case SDL_MOUSEWHEEL:
-				if (Vol.touch) {
-					Vol.temp = set_volume(Vol.temp + (x ?: y));
-				} else if (Board_touch && Info.hook) {
-					show_info_window();
-				}
-				break;
-			case SDL_WINDOWEVENT:
-				switch(event.window.event) {
-				case SDL_WINDOWEVENT_SIZE_CHANGED:
-				case SDL_WINDOWEVENT_MAXIMIZED:
-				case SDL_WINDOWEVENT_MINIMIZED:
-					status.update_needed = true;
-				}
+		}
+		else if ((Vol.hook = Vol.touch)) {
+			Vol.temp = set_volume(x);
+		}
+		else if (_Is_onElement(Restart, x, y)) {
+			if (board_running(engine)) {
+				snd_play(
+					check_hiscores(board_score(engine)) ? SND_HISCORE : SND_GAMEOVER, 1);
 			}
+			game_restart(true);
+		}
+		else if (_Is_onElement(Music, x, y)) {
+			music_switch();
+		}
+		else if ((Track.hook = _Is_onElement(Track, x, y))) {
+			track_switch();
+		}
+		else if (_Is_onElement(Loop, x, y)) {
+			draw_Button_for(&Loop, (Settings.loop ^= 1));
+		}
+		else if (_Is_onElement(Info, x, y)) {
+			Info.hook ? hide_info_window() : show_info_window();
+		}
+		break;
+	case SDL_MOUSEWHEEL:
+		if (Vol.touch) {
+			Vol.temp = set_volume(Vol.temp + (x ?: y));
+		} else if (Board_touch && Info.hook) {
+			show_info_window();
+		}
+		break;
+	case SDL_WINDOWEVENT:
+		switch(event->window.event) {
+		case SDL_WINDOWEVENT_HIDDEN:
+		case SDL_WINDOWEVENT_MINIMIZED:
+			status.hidden = true;
+			break;
+		case SDL_WINDOWEVENT_SHOWN:
+		case SDL_WINDOWEVENT_RESTORED:
+		case SDL_WINDOWEVENT_EXPOSED:
+		case SDL_WINDOWEVENT_SIZE_CHANGED:
+		case SDL_WINDOWEVENT_MAXIMIZED:
+			status.hidden = false;
+			gfx_expose();
+			status.update_needed = true;
 		}
 	}
-	if (board_running())
-		board_save(SAVE_PATH);
 }
 
-int cur_score = -1;
-int cur_mul = 0;
+/* Input, ticks, drawing and presenting all on this thread. Ticks keep to
+ * the clock: the wait is whatever is left of the step once the frame is
+ * done, and a late frame runs the missed ticks back to back. With nothing
+ * to animate there are no ticks at all, only a wake for the clock. */
+static void game_loop() {
+	// Main loop
+	SDL_Event event;
+	Uint64 freq = SDL_GetPerformanceFrequency();
+	Uint64 step = freq * TICK_MS / 1000;
+	Uint64 now, next = SDL_GetPerformanceCounter();
+	int n, ms;
+
+	while (status.running) {
+		now = SDL_GetPerformanceCounter();
+		if (!game_busy()) {
+			if ((ms = wait_GameTimer()) < 0 ? SDL_WaitEvent(&event) :
+			    SDL_WaitEventTimeout(&event, ms))
+				game_input(&event);
+			next = now = SDL_GetPerformanceCounter(); /* no ticks to make up */
+		} else if (now < next && SDL_WaitEventTimeout(&event, (next - now) * 1000 / freq))
+			game_input(&event);
+		while (status.running && SDL_PollEvent(&event))
+			game_input(&event);
+		now = SDL_GetPerformanceCounter();
+		for (n = 0; now >= next && n < CATCHUP_MAX; n++) {
+			game_tick();
+			next += step;
+		}
+		if (now >= next) /* too far behind, drop the time */
+			next = now + step;
+		if (status.update_needed) {
+			gfx_update();
+			status.update_needed = false;
+		}
+	}
+	if (board_running(engine))
+		board_save(engine, SAVE_PATH);
+}
 
 static void show_score(void)
 {
-	static unsigned short timer = 0;
-
 	int w, x, h   = gfx_font_height();
-	int new_score = board_score();
+	int new_score = played.score;
 	
-	if (board_score_mul() < cur_mul)
-		cur_mul = board_score_mul();
+	if (played.score_mul < cur_mul)
+		cur_mul = played.score_mul;
 	
 	if (new_score > cur_score || cur_score == -1) {
-		if ((board_score_mul() > cur_mul) && (board_score_mul() > 1) && !(timer % BONUS_BLINKS)) {
-			snprintf(Score.name, sizeof(Score.name), "Bonus x%d", board_score_mul());
+		if ((played.score_mul > cur_mul) && (played.score_mul > 1) && !(score_timer % BONUS_BLINKS)) {
+			snprintf(Score.name, sizeof(Score.name), "Bonus x%d", played.score_mul);
 			w = gfx_chars_width(Score.name);
 			x = SCORE_X + ((SCORE_W - w) / 2);
 			gfx_draw_bg(bg, _min(Score.x, x), SCORE_Y, _max(Score.w, w), h);
-			if ((timer / BONUS_BLINKS) & 1)
+			if ((score_timer / BONUS_BLINKS) & 1)
 				gfx_draw_text(Score.name, x, SCORE_Y, 0);
 			status.update_needed = true;
 			Score.x = x;
 			Score.w = w;
-			if (!timer) {
+			if (!score_timer) {
 				snd_play(SND_BONUS, 1);
-				timer = BONUS_TIMER;
+				score_timer = BONUS_TIMER;
 			}
-		} else if (!timer) {
+		} else if (!score_timer) {
 			snprintf(Score.name, sizeof(Score.name), "SCORE: %d", ++cur_score);
 			w = gfx_chars_width(Score.name);
 			x = SCORE_X + ((SCORE_W - w) / 2);
@@ -1101,11 +1444,11 @@ static void show_score(void)
 			}
 		}
 	}
-	if (timer == 1) {
-		cur_mul = board_score_mul();
+	if (score_timer == 1) {
+		cur_mul = played.score_mul;
 	}
-	if (timer)
-		timer--;
+	if (score_timer)
+		score_timer--;
 }
 
 static void game_savehiscores(const char *path)
@@ -1191,25 +1534,64 @@ static void game_message(const char *str, bool board)
 	gfx_draw_text(str, x, y, 0);
 }
 
+/* audio and the first track; not having sound is no error */
+static bool load_sound(void *unused)
+{
+	if ((Music.hook = snd_init()))
+		return false;
+	snd_volume(Settings.volume);
+	if (Settings.music > -1)
+		snd_music_start(Settings.music, Track.name);
+	return false;
+}
+
+static bool load_ui_image(void *arg)
+{
+	struct { img_t *img; const char *file; } *ui = arg;
+	return !(*ui->img = gfx_load_image(ui->file, true));
+}
+
+/* shows the Loading frame, then loads the rest and the sound in parallel */
 bool load_game_ui(void)
 {
+	static struct { img_t *img; const char *file; } ui[] = {
+		{ &cell, "cell.png" }, { &pb_logo, "pb_logo.png" },
+	};
+	elemen_t *buttons[] = { &Music, &Info, &Loop, &Vol };
+	task_t task[BALLS_NR + 7];
+	int nr = 0, i;
+	bool err = false;
+
 	if(!(bg      = gfx_load_image("bg.png"     ,false))) return true;
-	if(!(cell    = gfx_load_image("cell.png"   , true))) return true;
-	if(!(pb_logo = gfx_load_image("pb_logo.png", true))) return true;
 	
 	gfx_draw_bg(bg, 0, 0, SCREEN_W, SCREEN_H);
 	game_message("Loading...", false);
 	gfx_update();
 
-	return load_balls()
-		|| load_Img_for( &Music )
-		|| load_Img_for( &Info  )
-		|| load_Img_for( &Loop  )
-		|| load_Img_for( &Vol   );
+	if(!(Preview.reach = gfx_new_image(TILE_WIDTH, TILE_HEIGHT, 0xFF, 0xFF, 0xFF, 0x28))) return true;
+	if(!(Preview.path  = gfx_new_image(TILE_WIDTH, TILE_HEIGHT, 0xFF, 0xFF, 0xFF, 0x70))) return true;
+
+	/* the longest first: audio device, then sprites, then small images */
+	task[nr++] = (task_t){ load_sound, NULL };
+	if (load_balls(task, &nr))
+		return true;
+	for (i = 0; i < sizeof(ui) / sizeof(ui[0]); i++)
+		task[nr++] = (task_t){ load_ui_image, &ui[i] };
+	for (i = 0; i < sizeof(buttons) / sizeof(buttons[0]); i++)
+		task[nr++] = (task_t){ load_Img_for, buttons[i] };
+	run_tasks(task, nr);
+
+	for (i = 0; i < nr; i++)
+		err |= task[i].err;
+	store_balls(!err);
+	return err || make_tiles();
 }
 
 void free_game_ui(void) {
 	gfx_free_image(pb_logo);
+	gfx_free_image(Preview.reach);
+	gfx_free_image(Preview.path);
+	gfx_free_image(tiles);
 	gfx_free_image(cell);
 	gfx_free_image(bg);
 	free_balls();
@@ -1222,7 +1604,6 @@ void free_game_ui(void) {
 static void game_prep(void)
 {
 	game_loadhiscores(SCORES_PATH);
-	game_lock();
 	
 	srand(time(NULL));
 	gfx_draw_bg(bg, 0, 0, SCREEN_W, SCREEN_H);
@@ -1257,35 +1638,41 @@ static void game_prep(void)
 	draw_Volume_bar();
 	if(Track.name[0])
 		draw_Track_title();
-	game_unlock();
 	
 	game_restart(
-		board_load(SAVE_PATH)
+		board_load(engine, SAVE_PATH)
 	);
 }
 
 static void game_restart(bool clean)
 {
-	game_lock();
 	stop_GameTimer();
-	status.update_needed = status.game_over = false;
+	status.game_over = false;
 	cur_score = -1;
 	cur_mul   = 0;
 	if (!clean) {
 		fetch_game_board();
-		cur_score += board_score();
-		cur_mul   += board_score_mul();
+		cur_score += board_score(engine);
+		cur_mul   += board_score_mul(engine);
 	} else {
-		board_init();
-		draw_Timer_digit((Settings.lastTime = -1), NULL);
+		board_init(engine);
+		Settings.lastTime = 0;
+		draw_Timer_digit();
 	}
+	board_snapshot(engine, &view);
+	game_drop_events();
+	played.score     = view.score;
+	played.score_mul = view.score_mul;
+	played.over      = !view.running;
+	played.resync    = false;
 	game_init();
+	game_process_board(); /* the desk it starts from comes with no events */
+	game_process_pool();
 	draw_board();
 	show_score();
 	show_hiscores();
-	gfx_update();
+	status.update_needed = true;
 	start_GameTimer();
-	game_unlock();
 }
 
 int main(int argc, char **argv) {
@@ -1307,6 +1694,15 @@ int main(int argc, char **argv) {
 	if (access(config_dir, F_OK ) == -1)
 		mkdir(config_dir, 0755);
 
+	/* generated sprites, safe to delete */
+	snprintf(CACHE_PATH, sizeof(CACHE_PATH), "%s/.cache", pw ? pw->pw_dir : ".");
+	if (access(CACHE_PATH, F_OK ) == -1)
+		mkdir(CACHE_PATH, 0755);
+	strcat(CACHE_PATH, "/color-lines");
+	if (access(CACHE_PATH, F_OK ) == -1)
+		mkdir(CACHE_PATH, 0755);
+	strcat(CACHE_PATH, "/balls.cache");
+
 	do {
 		c--;
 	} while (GAME_DIR[c] != '/');
@@ -1314,39 +1710,29 @@ int main(int argc, char **argv) {
 	GAME_DIR[c + 1] = '\0';
 	
 	// Initialize SDL
-	if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_AUDIO | SDL_INIT_VIDEO) < 0) {
+	if (SDL_Init(SDL_INIT_AUDIO | SDL_INIT_VIDEO) < 0) {
 		fprintf(stderr, "Couldn't initialize SDL: %s\n", SDL_GetError());
 		return -1;
 	}
-	if (!(game_mutex = SDL_CreateMutex())) {
-		fprintf(stderr, "Couldn't create mutex: %s\n", SDL_GetError());
+	if (!(engine = board_new())) {
+		fprintf(stderr, "Couldn't create game engine\n");
 		return -1;
 	}
-	// Initialize Graphic and UI
+	board_events(engine, true);
+	// load settings before sound init
+	game_loadprefs(PREFS_PATH);
+	// Initialize Graphic, UI and Sound
 	if (gfx_init() || load_game_ui()) {
 		free_game_ui();
 		return -1;
 	}
-	// load settings before sound init
-	game_loadprefs(PREFS_PATH);
-	// Initialize Sound
-	if (snd_init()) {
-		Music.hook = true;
-	} else {
-		snd_volume(Settings.volume);
-		if (Settings.music > -1)
-			snd_music_start(Settings.music, Track.name);
-	}
 	game_prep();
 	game_loop();
 	/* END GAME CODE HERE */
-	game_lock();
-	stop_GameTimer();
 	free_game_ui();
-	game_unlock();
 	snd_done();
 	gfx_done();
-	SDL_DestroyMutex(game_mutex);
+	board_free(engine);
 	if (status.store_prefs)
 		game_saveprefs(PREFS_PATH);
 	SDL_Quit();
@@ -116,7 +116,7 @@ void snd_music_start(short num, char *name)
 			SND.title[i] = name[i] = '\0';
 		for (; i < strlen(SND.title); i++)
 			SND.title[i] = '\0';
-		Mix_HookMusicFinished(track_switch);
+		Mix_HookMusicFinished(music_finished);
 	}
 }
 
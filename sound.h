@@ -17,5 +17,5 @@ extern void snd_music_start(short num, char *name);
 extern void snd_music_stop(void);
 extern void snd_volume(short vol);
 extern char GAME_DIR[ PATH_MAX ];
-extern void track_switch(void);
+extern void music_finished(void); /* runs on the audio thread */
 #endif